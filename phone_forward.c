@@ -9,34 +9,134 @@
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "phone_forward.h"
 
 /** Iłość cyfr */
 #define SIZE 12
 
+/** Liczba słów filtra dwóch pierwszych cyfr, po jednym bicie na parę cyfr */
+#define FILTER_WORDS ((SIZE * SIZE + 63) / 64)
+
+/** Liczba miejsc w tablicy zapamiętanych łańcuchów przekierowań */
+#define MEMO_SIZE 64
+
+/** Liczba zapytań, które wsadowe wyszukiwanie przeplata ze sobą */
+#define BATCH_SIZE 16
+
+/** Zleca pobranie wierzchołka do pamięci podręcznej przed jego odczytem */
+#if defined(__GNUC__)
+#define PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define PREFETCH(addr) ((void) (addr))
+#endif
+
+/** Ostatnio nadana wersja. Wersje są unikalne dla wszystkich struktur, bo
+ * migawki mają te same wersje co oryginał w chwili ich utworzenia. Licznik
+ * jest atomowy, bo struktury mogą być zmieniane w różnych wątkach. */
+static atomic_ulong last_version = 0;
+
 /**@struct node
     @var prfx_arr - konkretny numer
     @var next - wskaznik na następny numer
-    @var parent - wskaznik na ojca
+    @var parent - wskaznik na poprzedni numer, używany tylko w ciągach
+                  wynikowych, bo końcówki list w drzewie są współdzielone;
+    @var refs - liczba wskaźników na ten element z wierzchołków lub
+                poprzednich elementów, używana tylko w listach w drzewie
  */
 struct node{
     char *prfx_arr;
     struct node *next;
     struct node *parent;
+    atomic_size_t refs;
 };
 typedef struct node node;
 
+/** @struct memo
+    @var num - numer, dla którego zapamiętano łańcuch;
+    @var result - ostatni numer łańcucha;
+    @var max_hops - limit kroków, z którym wyznaczono łańcuch;
+    @var status - sposób zakończenia łańcucha;
+    @var version - wersja struktury, w której wyznaczono łańcuch
+ */
+struct memo{
+    char *num;
+    char *result;
+    size_t max_hops;
+    PhoneChainStatus status;
+    unsigned long version;
+};
+typedef struct memo memo;
+
 /** @struct PhoneForward
     @var child - tablica synów każdej cyfry;
     @var prefix - struktura symboli , na którą zamieniamy prefix;
-    @var parent - wskaznik na poprzednij element;
+    @var parent - wskaznik na ojca, ustawiany dopiero przy zwalnianiu, gdy
+                  lista @p prefix jest już zwolniona, bo współdzielony
+                  wierzchołek może mieć wielu ojców;
+    @var refs - liczba wskaźników na ten wierzchołek z ojców lub korzeni,
+                zmieniana atomowo, bo migawki mogą być zwalniane w innych
+                wątkach niż oryginał;
+    @var fwd_count - liczba przekierowań w poddrzewie, używana tylko w
+                     drzewie numerów
  */
 struct PhoneForward{
     struct PhoneForward *child[SIZE];
-    node *prefix;
-    struct PhoneForward *parent;
+    union {
+        node *prefix;
+        struct PhoneForward *parent;
+    };
+    atomic_size_t refs;
+    size_t fwd_count;
 };
 typedef struct PhoneForward PhoneForward;
 
+/** @struct root
+    @var vertex - korzeń, którego synami są drzewo numerów i drzewo prefiksów;
+                  musi być pierwszym polem, bo struktura jest przekazywana na
+                  zewnątrz jako wskaźnik na ten wierzchołek;
+    @var memo - tablica MEMO_SIZE ostatnio wyznaczonych łańcuchów przekierowań;
+    @var version - wersja zawartości;
+    @var filter - bity par dwóch pierwszych cyfr, od których zaczyna się
+                  jakieś przekierowanie
+    Pola potrzebne tylko w korzeniu są tutaj, a nie w każdym wierzchołku.
+    Korzeń nigdy nie jest współdzielony, bo migawka dostaje własny.
+ */
+struct root{
+    PhoneForward vertex;
+    memo *memo;
+    unsigned long version;
+    uint64_t filter[FILTER_WORDS];
+};
+typedef struct root root;
+
+/** @struct descent
+    @var num - numer, którego dotyczy zapytanie;
+    @var vertex - wierzchołek, w którym jest zapytanie;
+    @var position - liczba cyfr numeru przeczytanych w drodze do @p vertex;
+    @var match - ostatni napotkany wierzchołek z przekierowaniem;
+    @var match_position - głębokość wierzchołka @p match
+ */
+struct descent{
+    char const *num;
+    PhoneForward *vertex;
+    size_t position;
+    PhoneForward *match;
+    size_t match_position;
+};
+typedef struct descent descent;
+
+/** @struct removal
+    @var num1 - numer przekierowywany;
+    @var num2 - numer, na który jest przekierowanie
+ */
+struct removal{
+    char const *num1;
+    char const *num2;
+};
+typedef struct removal removal;
+
 /** @struct PhoneNumbers
     @var numbers - wskaznik na listę numerów;
     @var arr_length - dłougość numeru
@@ -47,91 +147,255 @@ struct PhoneNumbers{
 };
 typedef struct PhoneNumbers PhoneNumbers;
 
+/** @struct stream
+    @var list - następny nieprzeczytany element listy prefiksów wierzchołka;
+    @var head - ostatnio przeczytany element listy, który nie jest prefiksem
+                następnego, lub NULL;
+    @var pending - przeczytane elementy listy, które są prefiksami dalszych
+                   elementów i czekają na wydanie;
+    @var pending_count - liczba elementów w @p pending;
+    @var pending_size - rozmiar tablicy @p pending;
+    @var top - najmniejszy element strumienia lub NULL, gdy się skończył;
+    @var top_index - indeks @p top w @p pending lub @p pending_count, gdy
+                     @p top to @p head;
+    @var suffix - końcówka numeru doklejana do każdego prefiksu
+ */
+struct stream{
+    node const *list;
+    char const *head;
+    char const **pending;
+    size_t pending_count;
+    size_t pending_size;
+    char const *top;
+    size_t top_index;
+    char const *suffix;
+};
+typedef struct stream stream;
+
+/** @struct PhoneCursor
+    @var snapshot - migawka struktury, po której przechodzi kursor;
+    @var num - kopia numeru, dla którego odwracamy przekierowania;
+    @var self - jednoelementowa lista z samym numerem @p num;
+    @var isGet - czy wydajemy tylko numery x, że phfwdGet(x) = num;
+    @var streams - strumienie prefiksów z wierzchołków na ścieżce numeru;
+    @var stream_count - liczba strumieni;
+    @var buffer - ostatnio wyznaczony numer;
+    @var buffer_size - rozmiar bufora;
+    @var started - czy w buforze jest już jakiś numer;
+    @var failed - czy nie udało się alokować pamięci
+ */
+struct PhoneCursor{
+    PhoneForward *snapshot;
+    char *num;
+    node self;
+    bool isGet;
+    stream *streams;
+    size_t stream_count;
+    char *buffer;
+    size_t buffer_size;
+    bool started;
+    bool failed;
+};
+typedef struct PhoneCursor PhoneCursor;
+
+/** @struct PhoneForwardIter
+    @var snapshot - migawka, po której przechodzi iterator;
+    @var stack - wierzchołki na ścieżce od korzenia drzewa numerów;
+    @var next - dla każdego wierzchołka ze ścieżki następna cyfra do odwiedzenia,
+                -1 jeśli sam wierzchołek nie był jeszcze odwiedzony;
+    @var path - numer bieżącego wierzchołka;
+    @var depth - głębokość bieżącego wierzchołka;
+    @var capacity - rozmiar tablic @p stack, @p next i @p path;
+    @var failed - czy iterator przestał działać z braku pamięci
+ */
+struct PhoneForwardIter{
+    PhoneForward *snapshot;
+    PhoneForward const **stack;
+    int *next;
+    char *path;
+    size_t depth;
+    size_t capacity;
+    bool failed;
+};
+typedef struct PhoneForwardIter PhoneForwardIter;
+
+/** @struct PhoneForwardDiff
+    @var from - migawka struktury źródłowej;
+    @var to - migawka struktury docelowej;
+    @var from_stack - wierzchołki źródła na bieżącej ścieżce, NULL gdzie
+                      źródło nie ma wierzchołka lub jego poddrzewo zostało
+                      już usunięte;
+    @var to_stack - wierzchołki celu na bieżącej ścieżce;
+    @var next - dla każdej głębokości następna cyfra do odwiedzenia,
+                -1 jeśli sama para wierzchołków nie była jeszcze porównana;
+    @var path - numer bieżącej pary wierzchołków;
+    @var depth - głębokość bieżącej pary;
+    @var capacity - rozmiar tablic @p from_stack, @p to_stack, @p next i @p path;
+    @var failed - czy porównanie przestało działać z braku pamięci
+ */
+struct PhoneForwardDiff{
+    PhoneForward *from;
+    PhoneForward *to;
+    PhoneForward const **from_stack;
+    PhoneForward const **to_stack;
+    int *next;
+    char *path;
+    size_t depth;
+    size_t capacity;
+    bool failed;
+};
+typedef struct PhoneForwardDiff PhoneForwardDiff;
+
 
-/** @brief Tworzy nową strukturę.
- * Tworzy nową strukturę niezawierającą żadnych przekierowań.
- * @return Wskaźnik na utworzoną strukturę lub NULL, gdy nie udało się
- *         alokować pamięci.
+/** @brief Tworzy nowy wierzchołek
+ *
+ * @return wskaznik na wierzchołek bez synów i przekierowań lub NULL, gdy nie
+ *         udało się alokować pamięci
  */
-PhoneForward * phfwdNew(void) {
+PhoneForward *vertexNew(void) {
     PhoneForward * tmp = (PhoneForward *) malloc(sizeof(PhoneForward));
     if (tmp == NULL) return NULL;
 
-    tmp->parent = NULL;
     tmp->prefix = NULL;
-    for(int i = 2; i < SIZE; i++)
+    tmp->refs = 1;
+    tmp->fwd_count = 0;
+    for (int i = 0; i < SIZE; i++)
         tmp->child[i] = NULL;
 
+    return tmp;
+}
 
-    tmp->child[0] = (PhoneForward *) malloc(sizeof(PhoneForward));
-    PhoneForward * tmp_num = tmp->child[0];
-    if(tmp_num == NULL) { free(tmp); return NULL; }
-    tmp_num->parent = tmp;
-    tmp_num->prefix = NULL;
+/** @brief Tworzy korzeń struktury
+ *
+ * @param[in] version - wersja zawartości
+ * @return wskaznik na korzeń bez synów lub NULL, gdy nie udało się alokować
+ *         pamięci
+ */
+root *rootNew(unsigned long version) {
+    root *tmp = malloc(sizeof(root));
+    if (tmp == NULL) return NULL;
+    tmp->vertex.prefix = NULL;
+    tmp->vertex.refs = 1;
+    tmp->vertex.fwd_count = 0;
     for (int i = 0; i < SIZE; i++)
-        tmp_num->child[i] = NULL;
+        tmp->vertex.child[i] = NULL;
+    tmp->memo = NULL;
+    tmp->version = version;
+    for (size_t i = 0; i < FILTER_WORDS; i++)
+        tmp->filter[i] = 0;
+    return tmp;
+}
 
-    tmp->child[1] = (PhoneForward *) malloc(sizeof(PhoneForward));
-    PhoneForward * tmp_pref = tmp->child[1];
-    if(tmp_pref == NULL) {
-        free(tmp);
-        free(tmp_num);
+/** @brief Tworzy nową strukturę.
+ * Tworzy nową strukturę niezawierającą żadnych przekierowań.
+ * @return Wskaźnik na utworzoną strukturę lub NULL, gdy nie udało się
+ *         alokować pamięci.
+ */
+PhoneForward * phfwdNew(void) {
+    root *record = rootNew(atomic_fetch_add(&last_version, 1) + 1);
+    if (record == NULL) return NULL;
+    PhoneForward *tmp = &record->vertex;
+
+    tmp->child[0] = vertexNew();
+    if (tmp->child[0] == NULL) { free(record); return NULL; }
+    tmp->child[1] = vertexNew();
+    if (tmp->child[1] == NULL) {
+        free(tmp->child[0]);
+        free(tmp->child[1]);
+        free(record);
         return NULL;
     }
-    tmp_pref->parent = tmp;
-    tmp_pref->prefix = NULL;
-    for (int i = 0; i < SIZE; i++)
-        tmp_pref->child[i] = NULL;
+    return tmp;
+}
 
+/** @brief Tworzy migawkę struktury.
+ * Nowy korzeń wskazuje na te same drzewa co @p pf. Wierzchołki są kopiowane
+ * dopiero wtedy, gdy któraś ze struktur chce je zmienić.
+ * @param[in] pf – wskaźnik na strukturę przechowującą przekierowania numerów;
+ * @return Wskaźnik na migawkę lub NULL, gdy nie udało się alokować pamięci.
+ */
+PhoneForward * phfwdSnapshot(PhoneForward const *pf) {
+    if (pf == NULL) return NULL;
+    root *record = rootNew(((root const *) pf)->version);
+    if (record == NULL) return NULL;
+    memcpy(record->filter, ((root const *) pf)->filter, sizeof(record->filter));
+
+    PhoneForward *tmp = &record->vertex;
+    for (int i = 0; i < 2; i++) {
+        tmp->child[i] = pf->child[i];
+        tmp->child[i]->refs++;
+    }
     return tmp;
 }
+
+/** @brief Usuwa tablicę zapamiętanych łańcuchów
+ *
+ * @param[in] table - wskaznik na usuwaną tablicę
+ */
+void memoDelete(memo *table) {
+    if (table == NULL) return;
+    for (size_t i = 0; i < MEMO_SIZE; i++) {
+        free(table[i].num);
+        free(table[i].result);
+    }
+    free(table);
+}
+
+/** @brief Zwalnia odwołanie do listy prefiksów
+ * Zwalnia kolejne elementy listy, dopóki nie trafi na element, na który
+ * wskazuje jeszcze coś innego.
+ * @param[in] head - pierwszy element zwalnianej listy
+ */
+void listDelete(node *head) {
+    while (head != NULL && --head->refs == 0) {
+        node *tmp = head->next;
+        free(head->prfx_arr);
+        free(head);
+        head = tmp;
+    }
+}
+
+/** @brief Zwalnia odwołanie do wierzchołka
+ * Zwalnia wierzchołek i jego poddrzewo bez rekurencji. Wierzchołki
+ * współdzielone z inną migawką zostają.
+ * @param[in] pf - wskaźnik na wierzchołek
+ */
+void vertexDelete(PhoneForward *pf) {
+    if (pf == NULL || --pf->refs > 0) return;
+
+    PhoneForward *current = pf;
+    listDelete(current->prefix);
+    current->parent = NULL;
+    while (current != NULL) {
+        bool check = false;
+        for (int i = 0; i < SIZE && !check; i++) {
+            PhoneForward *child = current->child[i];
+            if (child == NULL) continue;
+            current->child[i] = NULL;
+            if (--child->refs == 0) {
+                listDelete(child->prefix);
+                child->parent = current;
+                current = child;
+                check = true;
+            }
+        }
+        if (!check) {
+            PhoneForward *parent = current->parent;
+            free(current);
+            current = parent;
+        }
+    }
+}
+
 /** @brief Usuwa strukturę.
  * Usuwa strukturę wskazywaną przez @p pf. Nic nie robi, jeśli wskaźnik ten ma
- * wartość NULL.
+ * wartość NULL. Wierzchołki współdzielone z inną migawką zostają.
  * @param[in] pf – wskaźnik na usuwaną strukturę.
  */
 void phfwdDelete(PhoneForward *pf) {
-    if (pf != NULL) {
-        PhoneForward  *current = pf;
-        PhoneForward *parentRoot = pf->parent;
-        PhoneForward *root = pf;
-        bool first = true;
-
-        while (current != parentRoot) {
-            if(current == root && !first) root->child[0] = NULL;
-            bool check = false;
-            first = false;
-            for (int i = 0; i < SIZE; i++) {
-                if (current->child[i] != NULL) {
-                    current = current->child[i];
-                    check = true; break;
-                }
-            }
-            if (!check) {
-                PhoneForward *parent = current->parent;
-                if (parent != NULL)
-                    for (int i = 0; i < SIZE; i++)
-                        if (parent->child[i] == current) { parent->child[i] = NULL; break; }
-                node *head = current->prefix;
-                if(head!=NULL) {
-                    if(!parentRoot) {
-                        if(!root->child[0]) {
-                            while (head->next != NULL) {
-                                node *tmp = head->next;
-                                free(head->prfx_arr);
-                                free(head);
-                                head = tmp;
-                            }
-                        }
-                    }
-                    free(head->prfx_arr);
-                    free(head);
-                }
-                free(current);
-                current = parent;
-            }
-        }
-    }
+    if (pf == NULL) return;
+    memoDelete(((root *) pf)->memo);
+    vertexDelete(pf);
 }
 
 /** @brief Sprawdza , czy ciąg symboli jest numerem.
@@ -165,25 +429,188 @@ int get_digit(char num) {
 }
 
 
+/** @brief Zwraca znak odpowiadający cyfrze
+ *
+ * @param[in] digit - cyfra w systemie 12 cyfrowym
+ * @return znak cyfry
+ */
+char get_char(int digit) {
+    switch (digit) {
+        case 10 : return '*';
+        case 11 : return '#';
+        default : return (char) ('0' + digit);
+    }
+}
+
+/** @brief Kopiuje numer
+ *
+ * @param[in] num - kopiowany numer
+ * @return kopia numeru lub NULL, gdy nie udało się alokować pamięci
+ */
+char *copyNumber(char const *num) {
+    char *newnum = malloc(sizeof(char) * (strlen(num) + 1));
+    if (newnum == NULL) return NULL;
+    strcpy(newnum, num);
+    return newnum;
+}
+
 /** @brief Tworzy nowego syna
  *
  * @param[in] parent - wskaznik na ojca.
  * @param[in] index - index.
- * @return
+ * @return wskaznik na syna lub NULL, gdy nie udało się alokować pamięci
  */
 PhoneForward *newChild(PhoneForward *parent, int index) {
-    PhoneForward * newChild = (PhoneForward *) malloc(sizeof(PhoneForward));
+    PhoneForward * newChild = vertexNew();
     if (newChild == NULL) return NULL;
 
-    newChild->parent = parent;
     parent->child[index] = newChild;
-    newChild->prefix = NULL;
+    return newChild;
+}
 
-    for (int i = 0; i < SIZE; i++)
-        newChild->child[i] = NULL;
+/** @brief Tworzy element listy prefiksów
+ *
+ * @param[in] num - numer elementu
+ * @param[in] next - następny element, na który nowy element bierze odwołanie
+ * @return wskaznik na element lub NULL, gdy nie udało się alokować pamięci
+ */
+node *nodeNew(char const *num, node *next) {
+    node *item = malloc(sizeof(node));
+    if (item == NULL) return NULL;
+    item->prfx_arr = copyNumber(num);
+    if (item->prfx_arr == NULL) { free(item); return NULL; }
+    item->next = next;
+    item->parent = NULL;
+    item->refs = 1;
+    if (next) next->refs++;
+    return item;
+}
 
-    return newChild;
+/** @brief Zwraca element listy, który wolno zmieniać
+ * Jeśli element jest współdzielony z inną migawką, zastępuje go kopią, która
+ * wskazuje na ten sam następny element. Miejsce @p link musi już należeć
+ * tylko do zmienianej struktury.
+ * @param[in,out] link - wskaznik na miejsce, które wskazuje na element
+ * @return wskaznik na element lub NULL, gdy nie udało się alokować pamięci
+ */
+node *ownNode(node **link) {
+    node *item = *link;
+    if (item->refs == 1) return item;
+
+    node *copy = nodeNew(item->prfx_arr, item->next);
+    if (copy == NULL) return NULL;
+    *link = copy;
+    listDelete(item);
+    return copy;
 }
+
+/** @brief Zwraca syna, którego wolno zmieniać
+ * Jeśli syn jest współdzielony z inną migawką, zastępuje go kopią, która
+ * wskazuje na tych samych synów i tę samą listę prefiksów. Ojciec musi już
+ * należeć tylko do zmienianej struktury.
+ * @param[in,out] parent - wskaznik na ojca
+ * @param[in] index - index syna
+ * @return wskaznik na syna lub NULL, gdy syna nie ma lub nie udało się
+ *         alokować pamięci
+ */
+PhoneForward *ownChild(PhoneForward *parent, int index) {
+    PhoneForward *child = parent->child[index];
+    if (child == NULL || child->refs == 1) return child;
+
+    PhoneForward *copy = vertexNew();
+    if (copy == NULL) return NULL;
+    copy->prefix = child->prefix;
+    if (copy->prefix) copy->prefix->refs++;
+    copy->fwd_count = child->fwd_count;
+    for (int i = 0; i < SIZE; i++) {
+        copy->child[i] = child->child[i];
+        if (copy->child[i]) copy->child[i]->refs++;
+    }
+    parent->child[index] = copy;
+    vertexDelete(child);
+    return copy;
+}
+
+/** @brief Schodzi po numerze, kopiując współdzielone wierzchołki
+ *
+ * @param[in,out] pf - korzeń struktury
+ * @param[in] trie - 0 dla drzewa numerów, 1 dla drzewa prefiksów
+ * @param[in] num - numer
+ * @param[in] length - liczba cyfr numeru, po których schodzimy
+ * @param[in] create - czy tworzyć brakujące wierzchołki
+ * @return wskaznik na wierzchołek lub NULL, gdy go nie ma lub nie udało się
+ *         alokować pamięci
+ */
+PhoneForward *ownPath(PhoneForward *pf, int trie, char const *num, size_t length, bool create) {
+    PhoneForward *head = ownChild(pf, trie);
+    for (size_t i = 0; i < length && head != NULL; i++) {
+        int digit = get_digit(num[i]);
+        if (head->child[digit] == NULL)
+            head = create ? newChild(head, digit) : NULL;
+        else
+            head = ownChild(head, digit);
+    }
+    return head;
+}
+
+/** @brief Szuka wierzchołka numeru bez zmieniania struktury
+ *
+ * @param[in] trie - korzeń drzewa
+ * @param[in] num - numer
+ * @return wskaznik na wierzchołek lub NULL, gdy go nie ma
+ */
+PhoneForward *findVertex(PhoneForward const *trie, char const *num) {
+    PhoneForward *tmp = (PhoneForward *) trie;
+    for (size_t i = 0; num[i] != '\0' && tmp != NULL; i++)
+        tmp = tmp->child[get_digit(num[i])];
+    return tmp;
+}
+
+/** @brief Zmienia liczniki przekierowań na ścieżce numeru
+ * Wszystkie wierzchołki ścieżki muszą już należeć tylko do zmienianej
+ * struktury, np. po wywołaniu @ref ownPath.
+ * @param[in,out] trie - korzeń drzewa numerów
+ * @param[in] num - numer
+ * @param[in] length - liczba cyfr numeru, po których schodzimy
+ * @param[in] added - liczba dodanych przekierowań
+ * @param[in] removed - liczba usuniętych przekierowań
+ */
+void countPath(PhoneForward *trie, char const *num, size_t length, size_t added, size_t removed) {
+    PhoneForward *tmp = trie;
+    for (size_t i = 0; tmp != NULL; i++) {
+        tmp->fwd_count = tmp->fwd_count + added - removed;
+        tmp = i < length ? tmp->child[get_digit(num[i])] : NULL;
+    }
+}
+
+/** @brief Odświeża bity filtra dla numerów zaczynających się od cyfry
+ *
+ * @param[in,out] pf - korzeń struktury
+ * @param[in] first - pierwsza cyfra numerów
+ */
+void filterUpdate(root *pf, int first) {
+    PhoneForward const *head = pf->vertex.child[0]->child[first];
+    for (int i = 0; i < SIZE; i++) {
+        size_t bit = (size_t) first * SIZE + i;
+        bool any = head != NULL && (head->prefix != NULL ||
+                   (head->child[i] != NULL && head->child[i]->fwd_count > 0));
+        if (any) pf->filter[bit / 64] |= (uint64_t) 1 << (bit % 64);
+        else pf->filter[bit / 64] &= ~((uint64_t) 1 << (bit % 64));
+    }
+}
+
+/** @brief Sprawdza w filtrze, czy numer na pewno nie jest przekierowany
+ * Numery jednocyfrowe zawsze przechodzą dalej do drzewa.
+ * @param[in] pf - korzeń struktury
+ * @param[in] num - poprawny numer
+ * @return true , jak żaden prefiks numeru nie jest przekierowany
+ */
+bool filterRejects(root const *pf, char const *num) {
+    if (num[1] == '\0') return false;
+    size_t bit = (size_t) get_digit(num[0]) * SIZE + get_digit(num[1]);
+    return (pf->filter[bit / 64] >> (bit % 64) & 1) == 0;
+}
+
 /** @brief Porównuje ciąg numerów
  *
  * @param[in] num1 - numer 1
@@ -207,127 +634,185 @@ int strcmp_extended(const char *num1, const char *num2) {
 
 /** @brief Dodaje konkretne przekirowanie
  *
- * @param[in] pf – wskaźnik na strukturę przechowującą przekierowania
- *                     numerów;
- * @param[in] num – wskaźnik na napis reprezentujący prefiks numerów
- *                     przekierowywanych;
- * @param[in] nums_or_pref - sprawdza , czy możemy przekirowywać numer
- * @param[in] root -  wskaznik na strukturę prefiksów
+ * @param[in] pf – wskaźnik na wierzchołek, do którego dodajemy numer
+ * @param[in] num – wskaźnik na napis reprezentujący dodawany numer
+ * @param[in] nums_or_pref - true , jak dopisujemy numer do posortowanej listy
+ *                           prefiksów, false - jak zastępujemy przekierowanie
  * @return - true , jak uda się dodać przekirowanie , false - jak nie
  */
-bool AddPrefix(PhoneForward *pf, char const *num, bool nums_or_pref, node **root) {
-    size_t pref_length = strlen(num) + 1;
-    node *head = pf->prefix;
-    if (nums_or_pref && head) {
-        while (head->next) { if (strcmp_extended(num, head->next->prfx_arr) < 1) break; head = head->next; }
-
-        node *next = head->next;
-        head->next = malloc(sizeof(node));
-        if (!head->next) return false;
-        head->next->prfx_arr = malloc(sizeof(char) * (strlen(num) + 1));
-        if(head->next->prfx_arr == NULL) return false;
-        strcpy(head->next->prfx_arr, num);
-        head->next->next = next;
-        head->next->parent = head;
-        if (!head->next->prfx_arr) { free(head->next); return false; }
-        *root = head->next;
+bool AddPrefix(PhoneForward *pf, char const *num, bool nums_or_pref) {
+    if (!nums_or_pref && pf->prefix != NULL) {
+        node *head = ownNode(&pf->prefix);
+        char *newnum = copyNumber(num);
+        if (head == NULL || newnum == NULL) { free(newnum); return false; }
+        free(head->prfx_arr);
+        head->prfx_arr = newnum;
         return true;
-    } else {
-        if (head != NULL) { free(head->prfx_arr); free(head); }
-        head = (node *) malloc(sizeof(node));
+    }
+
+    node **link = &pf->prefix;
+    while (*link != NULL && strcmp_extended((*link)->prfx_arr, num) < 0) {
+        node *head = ownNode(link);
         if (head == NULL) return false;
-        head->prfx_arr = (char *) malloc(sizeof(char) * (size_t) pref_length);
-        if (head->prfx_arr == NULL) {root = NULL; return false; }
-        strcpy(head->prfx_arr, num);
-        head->next = NULL;
-        pf->prefix = head;
-        head->parent = NULL;
-        *root = head;
-        return true;
+        link = &head->next;
     }
+    node *item = nodeNew(num, *link);
+    if (item == NULL) return false;
+    if (*link) (*link)->refs--;
+    *link = item;
+    return true;
 }
 
 /** przekierowuje działanie na drzewo prefiksów lub drzewo numerów
  *
  * @param[in] pf – wskaźnik na strukturę przechowującą przekierowania
  *                     numerów;
+ * @param[in] trie - 0 dla drzewa numerów, 1 dla drzewa prefiksów
  * @param[in] num1   – wskaźnik na napis reprezentujący prefiks numerów
  *                     przekierowywanych;
  * @param[in] num2   – wskaźnik na napis reprezentujący prefiks numerów,
  *                     na które jest wykonywane przekierowanie.
  * @param[in] num_or_pref - sprawdza , czy możemy przekirowywać numer
- * @param[in] root -  wskaznik na strukturę prefiksów
  * @return true , jak udało się dodać
  */
+bool phfwdAdd_divider(PhoneForward *pf, int trie, char const *num1, char const *num2, bool num_or_pref) {
+    PhoneForward *head = ownPath(pf, trie, num1, strlen(num1), true);
+    if (head == NULL) return false;
+    return AddPrefix(head, num2, num_or_pref);
+}
 
-bool phfwdAdd_divider(PhoneForward *pf, char const *num1, char const *num2, bool num_or_pref, node **root) {
-    if (num1 == NULL || num2 == NULL) return false;
-    if (check_num(num1) && check_num(num2)) {
-        if (strcmp_extended(num1, num2) == 0) return false;
-        PhoneForward *head = pf;
-        size_t length = strlen(num1);
-        for (size_t i = 0; i < length; i++) {
-            if (head->child[get_digit(num1[i])] != NULL)
-                head = head->child[get_digit(num1[i])];
-            else {
-                head = newChild(head, get_digit(num1[i]));
-                if (head == NULL) return false;
-            }
+/** @brief usuwanie prefiksów z jednej listy
+ * Usuwa numery @p num1 grupy z listy prefiksów wierzchołka @p num2 w drzewie
+ * prefiksów jednym przejściem po liście, bo grupa i lista są posortowane tak
+ * samo. Kopiuje tylko współdzielone elementy przed ostatnim usuwanym.
+ * @param[in] pf  – wskaźnik na strukturę przechowującą przekierowania
+ *                     numerów;
+ * @param[in] group - przekierowania o tym samym @p num2, posortowane według
+ *                    @p num1
+ * @param[in] count - liczba przekierowań w grupie
+ * @return false , jak nie udało się alokować pamięci
+ */
+bool prfxDelete(PhoneForward *pf, removal const *group, size_t count) {
+    char const *num2 = group[0].num2;
+    if (findVertex(pf->child[1], num2) == NULL) return true;
+    PhoneForward *tmp = ownPath(pf, 1, num2, strlen(num2), false);
+    if (tmp == NULL) return false;
+
+    node **link = &tmp->prefix;
+    size_t i = 0;
+    while (i < count && *link != NULL) {
+        int cmp = strcmp_extended((*link)->prfx_arr, group[i].num1);
+        if (cmp > 0) { i++; continue; }
+        if (cmp == 0) {
+            node *item = *link;
+            *link = item->next;
+            if (item->next) item->next->refs++;
+            listDelete(item);
+            i++;
+            continue;
         }
-        if (!AddPrefix(head, num2, num_or_pref, root)) return false;
-        return true;
-    } else return false;
+        node *head = ownNode(link);
+        if (head == NULL) return false;
+        link = &head->next;
+    }
+    return true;
 }
 
 bool phfwdAdd(PhoneForward *pf, char const *num1, char const *num2) {
     if(pf == NULL) return false;
-    node *numbers = NULL;
-    node *prefix = NULL;
-    bool nums = phfwdAdd_divider(pf->child[0], num1, num2, false, &numbers);
-    if (nums == false) { free(numbers); return false; }
-    bool pref = phfwdAdd_divider(pf->child[1], num2, num1, true, &prefix);
-    if(pref == true) { numbers->next = prefix; return true; }
-    else return false;
+    if (!check_num(num1) || !check_num(num2)) return false;
+    if (strcmp_extended(num1, num2) == 0) return false;
+    ((root *) pf)->version = atomic_fetch_add(&last_version, 1) + 1;
+
+    PhoneForward const *old = findVertex(pf->child[0], num1);
+    bool fresh = old == NULL || old->prefix == NULL;
+    if (!fresh) {
+        if (strcmp_extended(old->prefix->prfx_arr, num2) == 0) return true;
+        removal single = { num1, old->prefix->prfx_arr };
+        if (!prfxDelete(pf, &single, 1)) return false;
+    }
+    if (!phfwdAdd_divider(pf, 0, num1, num2, false)) return false;
+    if (fresh) {
+        countPath(pf->child[0], num1, strlen(num1), 1, 0);
+        filterUpdate((root *) pf, get_digit(num1[0]));
+    }
+    return phfwdAdd_divider(pf, 1, num2, num1, true);
 }
 
-/** @brief usuwanie konkretnego prefiksu
- *
- * @param[in] pf  – wskaźnik na strukturę przechowującą przekierowania
- *                     numerów;
- * @param[in] head  -  wskaznik na strukturę prefiksów
+/** Pomocnicza funkcja do usuwania prefiksów
+ * Zbiera przekierowania z poddrzewa numerów @p tmp.
+ * @param[in] tmp - pomocniczy wskaznik
+ * @param[in,out] path - bufor z numerem wierzchołka @p tmp
+ * @param[in,out] size - rozmiar bufora
+ * @param[in] depth - długość numeru wierzchołka @p tmp
+ * @param[out] list - tablica na przekierowania, numery @p num1 są kopiami
+ * @param[in,out] count - liczba zebranych przekierowań
+ * @return false , jak nie udało się alokować pamięci
  */
-void prfxDelete(PhoneForward *pf, node *head){
-    node *prefix = head->next;
-    char *num = head->prfx_arr;
-    if (prefix->parent != NULL) {
-        prefix->parent->next = prefix->next;
-        if (prefix->next) prefix->next->parent = prefix->parent;
-        free(prefix->prfx_arr);
-        free(prefix);
+bool prfxDeleteHelp(PhoneForward const *tmp, char **path, size_t *size, size_t depth,
+                    removal *list, size_t *count){
+    if(tmp == NULL) return true;
+    if (depth + 1 >= *size) {
+        char *bigger = realloc(*path, sizeof(char) * *size * 2);
+        if (bigger == NULL) return false;
+        *path = bigger;
+        *size *= 2;
     }
-    else {
-        PhoneForward *tmp = pf->child[1];
-        for(size_t i = 0; i < strlen(num); i++)
-            tmp = tmp->child[get_digit(num[i])];
-        tmp->prefix = prefix->next;
-        free(prefix->prfx_arr);
-        free(prefix);
-        if (tmp->prefix) tmp->prefix->parent = NULL;
+    (*path)[depth] = '\0';
+    if(tmp->prefix) {
+        list[*count].num1 = copyNumber(*path);
+        list[*count].num2 = tmp->prefix->prfx_arr;
+        if (list[*count].num1 == NULL) return false;
+        (*count)++;
     }
+    for(int i = 0; i < SIZE; i++) {
+        (*path)[depth] = get_char(i);
+        if (!prfxDeleteHelp(tmp->child[i], path, size, depth + 1, list, count)) return false;
+    }
+    return true;
 }
 
-/** Pomocnicza funkcja do usuwania prefiksów
- *
- * @param[in] pf – wskaźnik na strukturę przechowującą przekierowania
- *             numerów;
- * @param[in] tmp - pomocniczy wskaznik
+/** @brief Porównuje przekierowania według numeru docelowego, potem
+ * przekierowywanego, dla qsort
+ * @param[in] a - wskaźnik na pierwsze przekierowanie
+ * @param[in] b - wskaźnik na drugie przekierowanie
+ * @return wynik porównania
  */
-void prfxDeleteHelp(PhoneForward *pf,PhoneForward *tmp){
-    if(tmp == NULL) return;
-    if(tmp->prefix){ prfxDelete(pf,tmp->prefix); tmp->prefix->next = NULL; }
-    for(int i = 0; i < SIZE; i++)
-        prfxDeleteHelp(pf,tmp->child[i] );
+int removalCmp(void const *a, void const *b) {
+    removal const *x = a, *y = b;
+    int cmp = strcmp_extended(x->num2, y->num2);
+    return cmp != 0 ? cmp : strcmp_extended(x->num1, y->num1);
 }
+
+/** @brief Usuwa z drzewa prefiksów wszystkie przekierowania z poddrzewa
+ * Zbiera przekierowania poddrzewa, sortuje je według numeru docelowego i
+ * każdą listę prefiksów przechodzi raz, więc koszt nie rośnie z kwadratem
+ * liczby przekierowań na ten sam numer.
+ * @param[in,out] pf - struktura
+ * @param[in] tmp - wierzchołek usuwanego poddrzewa numerów
+ * @param[in] num - numer wierzchołka @p tmp
+ * @return false , jak nie udało się alokować pamięci
+ */
+bool prfxDeleteSubtree(PhoneForward *pf, PhoneForward const *tmp, char const *num) {
+    if (tmp->fwd_count == 0) return true;
+    removal *list = malloc(sizeof(removal) * tmp->fwd_count);
+    size_t length = strlen(num), size = length + 1, count = 0;
+    char *path = copyNumber(num);
+    bool ok = list != NULL && path != NULL &&
+              prfxDeleteHelp(tmp, &path, &size, length, list, &count);
+    free(path);
+
+    if (ok) qsort(list, count, sizeof(removal), removalCmp);
+    for (size_t start = 0, end; ok && start < count; start = end) {
+        for (end = start + 1; end < count && strcmp_extended(list[end].num2, list[start].num2) == 0; end++);
+        ok = prfxDelete(pf, list + start, end - start);
+    }
+    for (size_t i = 0; list != NULL && i < count; i++)
+        free((char *) list[i].num1);
+    free(list);
+    return ok;
+}
+
 /** @brief Usuwa przekierowania.
  * Usuwa wszystkie przekierowania, w których parametr @p num jest prefiksem
  * parametru @p num1 użytego przy dodawaniu. Jeśli nie ma takich przekierowań
@@ -340,17 +825,20 @@ void prfxDeleteHelp(PhoneForward *pf,PhoneForward *tmp){
 void phfwdRemove(PhoneForward *pf, char const *num) {
     if (pf == NULL) return;
     if (!check_num(num)) return;
-    PhoneForward * tmp = pf->child[0];
-    size_t length = strlen(num);
+    PhoneForward *tmp = findVertex(pf->child[0], num);
+    if (tmp == NULL) return;
+    ((root *) pf)->version = atomic_fetch_add(&last_version, 1) + 1;
+    if (!prfxDeleteSubtree(pf, tmp, num)) return;
 
-    for (size_t i = 0; i < length; i++)
-        if(tmp->child[get_digit(num[i])])
-            tmp = tmp->child[get_digit(num[i])];
-        else return;
-
-    prfxDeleteHelp(pf, tmp);
-    phfwdDelete(tmp);
-    tmp = NULL;
+    size_t length = strlen(num);
+    PhoneForward *parent = ownPath(pf, 0, num, length - 1, false);
+    if (parent == NULL) return;
+    int digit = get_digit(num[length - 1]);
+    tmp = parent->child[digit];
+    parent->child[digit] = NULL;
+    countPath(pf->child[0], num, length - 1, 0, tmp->fwd_count);
+    filterUpdate((root *) pf, get_digit(num[0]));
+    vertexDelete(tmp);
 }
 
 /** @brief realizacja przekirowania numeru
@@ -376,6 +864,111 @@ char * Forward(size_t position, char * prefix, const char * num) {
     return newnum;
 }
 
+/** @brief Tworzy ciąg zawierający jeden numer
+ *
+ * @param[in] newnum - napis, który staje się jedynym elementem ciągu
+ * @return Wskaźnik na strukturę przechowującą ciąg numerów lub NULL, gdy nie
+ *         udało się alokować pamięci.
+ */
+PhoneNumbers *singleNumber(char *newnum) {
+    if (newnum == NULL) return NULL;
+    PhoneNumbers *pnum = (PhoneNumbers *) malloc(sizeof(PhoneNumbers));
+    if (pnum == NULL) { free(newnum); return NULL; }
+    pnum->numbers = malloc(sizeof(node));
+    if (pnum->numbers == NULL) { free(newnum); free(pnum); return NULL; }
+
+    pnum->numbers->next = NULL;
+    pnum->numbers->parent = NULL;
+    pnum->numbers->prfx_arr = newnum;
+    pnum->arr_length = 1;
+    return pnum;
+}
+
+/** @brief Tworzy pusty ciąg numerów
+ *
+ * @return Wskaźnik na strukturę przechowującą ciąg numerów lub NULL, gdy nie
+ *         udało się alokować pamięci.
+ */
+PhoneNumbers *emptyNumbers(void) {
+    PhoneNumbers *pnum = (PhoneNumbers *) malloc(sizeof(PhoneNumbers));
+    if (pnum == NULL) return NULL;
+    pnum->numbers = NULL;
+    pnum->arr_length = 0;
+    return pnum;
+}
+
+/** @brief Wykonuje jeden krok zejścia w dół drzewa
+ * Przechodzi do syna odpowiadającego kolejnej cyfrze numeru i zleca
+ * procesorowi pobranie go do pamięci podręcznej. Syn zostanie odczytany
+ * dopiero w następnej rundzie, więc w tym czasie pozostałe zapytania z grupy
+ * mogą wykonywać swoje kroki.
+ * @param[in,out] q - stan zapytania
+ * @return true , jak udało się zejść niżej, false - jak zejście się skończyło
+ */
+bool descentAdvance(descent *q) {
+    char c = q->num[q->position];
+    if (c == '\0') return false;
+    PhoneForward *next = q->vertex->child[get_digit(c)];
+    if (next == NULL) return false;
+    PREFETCH(next);
+    q->vertex = next;
+    q->position++;
+    return true;
+}
+
+/** @brief Szuka najdłuższych pasujących prefiksów dla grupy numerów
+ * Schodzi jednocześnie po drzewie numerów dla wszystkich zapytań z grupy,
+ * po jednej cyfrze na rundę, tak aby chybienia w pamięci podręcznej
+ * poszczególnych zapytań nakładały się na siebie. Zapytania odrzucone przez
+ * filtr dwóch pierwszych cyfr w ogóle nie schodzą, a pozostałe kończą się,
+ * gdy poniżej wierzchołka nie ma już przekierowań. Ostatni napotkany
+ * wierzchołek z przekierowaniem jest najbliższym przekierowanym przodkiem,
+ * więc nie trzeba wracać w górę drzewa.
+ * @param[in] pf - korzeń struktury
+ * @param[in,out] group - stany zapytań, pole @p num musi być ustawione
+ * @param[in] count - liczba zapytań w grupie, co najwyżej BATCH_SIZE
+ */
+void findForwards(PhoneForward const *pf, descent *group, size_t count) {
+    PhoneForward *trie = pf->child[0];
+    size_t active[BATCH_SIZE];
+    size_t left = 0;
+    for (size_t j = 0; j < count; j++) {
+        group[j].vertex = trie;
+        group[j].position = 0;
+        group[j].match = NULL;
+        group[j].match_position = 0;
+        if (group[j].num != NULL && !filterRejects((root const *) pf, group[j].num))
+            active[left++] = j;
+    }
+
+    while (left > 0) {
+        for (size_t k = 0; k < left; ) {
+            descent *q = &group[active[k]];
+            bool below = q->vertex->fwd_count > 0;
+            if (q->vertex->prefix) {
+                q->match = q->vertex;
+                q->match_position = q->position;
+                below = q->vertex->fwd_count > 1;
+            }
+            if (below && descentAdvance(q)) k++;
+            else active[k] = active[--left];
+        }
+    }
+}
+
+/** @brief realizacja wyniku zapytania o przekierowanie
+ *
+ * @param[in] q - stan zakończonego zapytania
+ * @return Wskaźnik na strukturę przechowującą ciąg numerów lub NULL, gdy nie
+ *         udało się alokować pamięci.
+ */
+PhoneNumbers *forwardResult(descent const *q) {
+    if (q->num == NULL) return emptyNumbers();
+    if (q->match != NULL)
+        return singleNumber(Forward(q->match_position, q->match->prefix->prfx_arr, q->num));
+    return singleNumber(copyNumber(q->num));
+}
+
 /** @brief Wyznacza przekierowanie numeru.
  * Wyznacza przekierowanie podanego numeru. Szuka najdłuższego pasującego
  * prefiksu. Wynikiem jest ciąg zawierający co najwyżej jeden numer. Jeśli dany
@@ -391,49 +984,91 @@ char * Forward(size_t position, char * prefix, const char * num) {
 PhoneNumbers * phfwdGet(PhoneForward const *pf, char const *num) {
     if (pf == NULL) return NULL;
 
-    PhoneNumbers *pnum = (PhoneNumbers *) malloc(sizeof(PhoneNumbers));
-    if(pnum == NULL) return NULL;
-    PhoneForward  *tmp = (PhoneForward *) pf->child[0];
-
-    if (!check_num(num)) {
-        pnum->numbers = NULL;
-        return pnum;
-    } else {
-        pnum->numbers =  malloc(sizeof(node));
-        if (pnum->numbers == NULL) { free(pnum); return NULL; }
-    }
+    descent q;
+    q.num = check_num(num) ? num : NULL;
+    findForwards(pf, &q, 1);
+    return forwardResult(&q);
+}
 
-    pnum->numbers->next = NULL;
-    pnum->numbers->parent = NULL;
-    pnum->numbers->prfx_arr = NULL;
+/** @brief Sprawdza, czy numer jest przekierowany.
+ * Nie alokuje pamięci, więc numery odrzucone przez filtr nic nie kosztują.
+ * @param[in] pf  – wskaźnik na strukturę przechowującą przekierowania numerów;
+ * @param[in] num – wskaźnik na napis reprezentujący numer.
+ * @return true , jak któryś prefiks numeru jest przekierowany; false - jak nie
+ *         jest lub napis nie reprezentuje numeru
+ */
+bool phfwdIsForwarded(PhoneForward const *pf, char const *num) {
+    if (pf == NULL || !check_num(num)) return false;
 
-    char *newnum = NULL;
-    size_t i = 0;
+    descent q;
+    q.num = num;
+    findForwards(pf, &q, 1);
+    return q.match != NULL;
+}
 
-    for (; i < strlen(num); i++) {
-        if (tmp->child[get_digit(num[i])])
-            tmp = tmp->child[get_digit(num[i])];
-        else
-            break;
+/** @brief Wyznacza przekierowanie numeru do bufora.
+ * Działa jak @ref phfwdGet, ale zapisuje wynik w buforze podanym przez
+ * wywołującego, tak jak snprintf: zapisuje co najwyżej @p size - 1 znaków i
+ * zawsze kończy napis zerem, jeśli @p size jest dodatnie.
+ * @param[in] pf     – wskaźnik na strukturę przechowującą przekierowania numerów;
+ * @param[in] num    – wskaźnik na napis reprezentujący numer;
+ * @param[out] buffer – bufor na wynik, może być NULL, gdy @p size jest zerem;
+ * @param[in] size   – rozmiar bufora.
+ * @return długość całego wyniku bez kończącego zera; 0 - jak napis nie
+ *         reprezentuje numeru
+ */
+size_t phfwdGetInto(PhoneForward const *pf, char const *num, char *buffer, size_t size) {
+    if (size > 0) buffer[0] = '\0';
+    if (pf == NULL || !check_num(num)) return 0;
+
+    descent q;
+    q.num = num;
+    findForwards(pf, &q, 1);
+    char const *head = q.match ? q.match->prefix->prfx_arr : "";
+    char const *tail = num + q.match_position;
+    size_t head_length = strlen(head), tail_length = strlen(tail);
+    if (size > 0) {
+        size_t copied = head_length < size - 1 ? head_length : size - 1;
+        memcpy(buffer, head, copied);
+        size_t rest = tail_length < size - 1 - copied ? tail_length : size - 1 - copied;
+        memcpy(buffer + copied, tail, rest);
+        buffer[copied + rest] = '\0';
     }
-    for (; ; i--) {
-        if (tmp == NULL) {
-            newnum = malloc(sizeof(char) * (strlen(num)+1));
-            if(newnum == NULL) return NULL;
-            strcpy(newnum, num);
-            break;
-        } else {
-            if (tmp->prefix) {
-                newnum = Forward(i, tmp->prefix->prfx_arr, num);
-                break;
-            } else
-                tmp = tmp->parent;
+    return head_length + tail_length;
+}
+
+/** @brief Wyznacza przekierowania grupy numerów.
+ * Działa jak wywołanie @ref phfwdGet dla każdego z numerów, ale zapytania są
+ * przetwarzane grupami po BATCH_SIZE.
+ * @param[in] pf      – wskaźnik na strukturę przechowującą przekierowania
+ *                      numerów;
+ * @param[in] nums    – tablica numerów;
+ * @param[in] count   – liczba numerów;
+ * @param[out] results – tablica na wyniki, które trzeba zwolnić za pomocą
+ *                       @ref phnumDelete.
+ * @return Wartość @p true, jeśli wyznaczono wszystkie wyniki. Wartość @p false,
+ *         jeśli nie udało się alokować pamięci - wtedy żaden wynik nie zostaje.
+ */
+bool phfwdGetBatch(PhoneForward const *pf, char const * const *nums, size_t count, PhoneNumbers **results) {
+    if (pf == NULL || (count > 0 && (nums == NULL || results == NULL))) return false;
+
+    descent group[BATCH_SIZE];
+    for (size_t start = 0; start < count; start += BATCH_SIZE) {
+        size_t size = count - start < BATCH_SIZE ? count - start : BATCH_SIZE;
+        for (size_t j = 0; j < size; j++)
+            group[j].num = check_num(nums[start + j]) ? nums[start + j] : NULL;
+
+        findForwards(pf, group, size);
+
+        for (size_t j = 0; j < size; j++) {
+            results[start + j] = forwardResult(&group[j]);
+            if (results[start + j] == NULL) {
+                for (size_t k = 0; k < start + j; k++) { phnumDelete(results[k]); results[k] = NULL; }
+                return false;
+            }
         }
     }
-
-    pnum->numbers->prfx_arr = newnum;
-    pnum->arr_length = 1;
-    return pnum;
+    return true;
 }
 
 /** @brief wylicza długość drzewa prefisków
@@ -501,18 +1136,14 @@ char const * phnumGet(PhoneNumbers const *pnum, size_t idx) {
  */
 bool getPrefix(const PhoneForward *pf, PhoneNumbers ** pnum, const char *num, node * prefix_list, size_t position, bool isGet){
     PhoneNumbers *tmp = * pnum;
-    node *numbers = tmp->numbers;
     size_t len = prefix_size(prefix_list);
     tmp->arr_length += len;
-    node *tmpnumbers;
 
-    bool flag = true;
-    for(size_t i = 0; i < len; i++) {
-        flag = true;
+    for(size_t i = 0; i < len; i++, prefix_list = prefix_list->next) {
         node *pref_tmp = malloc(sizeof(node));
         if (pref_tmp == NULL) return false;
-        tmpnumbers = numbers;
         pref_tmp->prfx_arr = Forward(position + 1, prefix_list->prfx_arr, num);
+        if (pref_tmp->prfx_arr == NULL) { free(pref_tmp); return false; }
         if(isGet){
             PhoneNumbers *pnum_tmp = phfwdGet(pf, pref_tmp->prfx_arr);
             if(strcmp_extended(phnumGet(pnum_tmp, 0), num) != 0){
@@ -520,63 +1151,89 @@ bool getPrefix(const PhoneForward *pf, PhoneNumbers ** pnum, const char *num, no
                 free(pref_tmp->prfx_arr);
                 tmp->arr_length--;
                 free(pref_tmp);
-                prefix_list = prefix_list->next;
                 continue;
             }
             phnumDelete(pnum_tmp);
         }
-        if(tmpnumbers == NULL){
-            pref_tmp->next = NULL;
-            pref_tmp->parent = NULL;
-            tmpnumbers = pref_tmp;
-            tmp->numbers = tmpnumbers;
-            flag = false;
+
+        node *prev = NULL;
+        node *tmpnumbers = tmp->numbers;
+        while (tmpnumbers != NULL && strcmp_extended(tmpnumbers->prfx_arr, pref_tmp->prfx_arr) < 0) {
+            prev = tmpnumbers;
+            tmpnumbers = tmpnumbers->next;
         }
-        else if(tmpnumbers->next != NULL) {
-            while (strcmp_extended(tmpnumbers->prfx_arr, pref_tmp->prfx_arr) < 1) {
-                if(strcmp_extended(tmpnumbers->prfx_arr, pref_tmp->prfx_arr) == 0){
-                    tmp->arr_length--;
-                    break;
-                }
-                if(tmpnumbers->next == NULL){
-                    pref_tmp->next = NULL;
-                    pref_tmp->parent = tmpnumbers;
-                    tmpnumbers->next = pref_tmp;
-                    flag = false;
-                    break;
-                }
-                tmpnumbers = tmpnumbers->next;
-            }
-            if(flag) {
-                pref_tmp->next = tmpnumbers;
-                pref_tmp->parent = tmpnumbers->parent;
-                if (pref_tmp->parent)pref_tmp->parent->next = pref_tmp;
-                else tmp->numbers = pref_tmp;
-                tmpnumbers->parent = pref_tmp;
-            }
+        if (tmpnumbers != NULL && strcmp_extended(tmpnumbers->prfx_arr, pref_tmp->prfx_arr) == 0) {
+            tmp->arr_length--;
+            free(pref_tmp->prfx_arr);
+            free(pref_tmp);
+            continue;
         }
-        else if (tmpnumbers->next == NULL){
-            if (strcmp_extended(tmpnumbers->prfx_arr, pref_tmp->prfx_arr) == -1) {
-                tmpnumbers->next = pref_tmp;
-                pref_tmp->next = NULL;
-                pref_tmp->parent = tmpnumbers;
-            }
-            else if (strcmp_extended(tmpnumbers->prfx_arr, pref_tmp->prfx_arr) == 1) {
-                pref_tmp->next = tmpnumbers;
-                tmpnumbers->parent = pref_tmp;
-                pref_tmp->parent = NULL;
-                tmp->numbers = numbers = pref_tmp;
-            }
-            else tmp->arr_length--;
-        }
-        prefix_list = prefix_list->next;
-        numbers = tmp->numbers;
-
+        pref_tmp->next = tmpnumbers;
+        pref_tmp->parent = prev;
+        if (tmpnumbers) tmpnumbers->parent = pref_tmp;
+        if (prev) prev->next = pref_tmp;
+        else tmp->numbers = pref_tmp;
     }
     *pnum = tmp;
     return true;
 }
 
+/** @brief Tworzy początkowy wynik odwrócenia przekierowań
+ * Wynik zawiera sam numer @p num lub jest pusty, jeśli napis nie reprezentuje
+ * numeru.
+ * @param[in] num – wskaźnik na napis reprezentujący numer.
+ * @return Wskaźnik na strukturę przechowującą ciąg numerów lub NULL, gdy nie
+ *         udało się alokować pamięci.
+ */
+PhoneNumbers *reverseInit(char const *num) {
+    if (!check_num(num)) return emptyNumbers();
+    return singleNumber(copyNumber(num));
+}
+
+/** @brief Odwraca przekierowania dla grupy numerów
+ * Schodzi jednocześnie po drzewie prefiksów dla wszystkich zapytań z grupy
+ * i w każdym odwiedzonym wierzchołku poza korzeniem dołącza numery z listy
+ * prefiksów.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów;
+ * @param[in] nums - tablica numerów
+ * @param[in] count - liczba numerów, co najwyżej BATCH_SIZE
+ * @param[out] results - tablica na wyniki
+ * @return true , jak udało się wyznaczyć wszystkie wyniki, false - jak nie
+ *         udało się alokować pamięci; wtedy wszystkie wyniki są zwolnione
+ */
+bool reverseGroup(PhoneForward const *pf, char const * const *nums, size_t count, PhoneNumbers **results) {
+    descent group[BATCH_SIZE];
+    size_t active[BATCH_SIZE];
+    size_t left = 0;
+    bool ok = true;
+
+    for (size_t j = 0; j < count; j++) {
+        results[j] = reverseInit(nums[j]);
+        if (results[j] == NULL) ok = false;
+        group[j].num = nums[j];
+        group[j].vertex = pf->child[1];
+        group[j].position = 0;
+        if (ok && results[j]->arr_length > 0 && descentAdvance(&group[j])) active[left++] = j;
+    }
+
+    while (ok && left > 0) {
+        for (size_t k = 0; k < left; ) {
+            descent *q = &group[active[k]];
+            if (q->vertex->prefix)
+                if (!getPrefix(pf, &results[active[k]], q->num, q->vertex->prefix, q->position - 1, false)) {
+                    ok = false;
+                    break;
+                }
+            if (descentAdvance(q)) k++;
+            else active[k] = active[--left];
+        }
+    }
+
+    if (!ok)
+        for (size_t j = 0; j < count; j++) { phnumDelete(results[j]); results[j] = NULL; }
+    return ok;
+}
+
 /** @brief Wyznacza przekierowania na dany numer.
  * Wyznacza następujący ciąg numerów: jeśli istnieje numer @p x, taki że wynik
  * wywołania @p phfwdGet z numerem @p x zawiera numer @p num, to numer @p x
@@ -590,45 +1247,37 @@ bool getPrefix(const PhoneForward *pf, PhoneNumbers ** pnum, const char *num, no
  * @return Wskaźnik na strukturę przechowującą ciąg numerów lub NULL, gdy nie
  *         udało się alokować pamięci.
  */
- PhoneNumbers *phfwdReverse(PhoneForward const *pf, char const *num) {
+PhoneNumbers *phfwdReverse(PhoneForward const *pf, char const *num) {
     if(pf == NULL) return NULL;
 
-    PhoneForward *tmp = pf->child[1];
-    PhoneNumbers *pnum = malloc(sizeof(PhoneNumbers));
-    if(pnum == NULL) return NULL;
-
-    if(!check_num(num)){
-        pnum->arr_length = 0;
-        pnum->numbers = NULL;
-        return pnum;
-    }
-    if(!num || !strlen(num) ){
-        pnum->arr_length = 0;
-        pnum->numbers = NULL;
-        return pnum;
-    }
-
-    pnum->numbers = malloc(sizeof(node));
-    if(pnum->numbers == NULL) { free(pnum); return NULL; }
+    PhoneNumbers *pnum = NULL;
+    if (!reverseGroup(pf, &num, 1, &pnum)) return NULL;
+    return pnum;
+}
 
-    pnum->numbers->prfx_arr = malloc(sizeof(char) * (strlen(num) + 1));
-    if(pnum->numbers->prfx_arr == NULL) return NULL;
-    strcpy(pnum->numbers->prfx_arr, num);
-    pnum->numbers->parent = NULL;
-    pnum->numbers->next = NULL;
-    pnum->arr_length = 1;
+/** @brief Wyznacza przekierowania na grupę numerów.
+ * Działa jak wywołanie @ref phfwdReverse dla każdego z numerów, ale zapytania
+ * są przetwarzane grupami po BATCH_SIZE.
+ * @param[in] pf      – wskaźnik na strukturę przechowującą przekierowania
+ *                      numerów;
+ * @param[in] nums    – tablica numerów;
+ * @param[in] count   – liczba numerów;
+ * @param[out] results – tablica na wyniki, które trzeba zwolnić za pomocą
+ *                       @ref phnumDelete.
+ * @return Wartość @p true, jeśli wyznaczono wszystkie wyniki. Wartość @p false,
+ *         jeśli nie udało się alokować pamięci - wtedy żaden wynik nie zostaje.
+ */
+bool phfwdReverseBatch(PhoneForward const *pf, char const * const *nums, size_t count, PhoneNumbers **results) {
+    if (pf == NULL || (count > 0 && (nums == NULL || results == NULL))) return false;
 
-    size_t numlen = strlen(num);
-    for(size_t i = 0; i < numlen; i++){
-        if(tmp->child[get_digit(num[i])])
-            tmp = tmp->child[get_digit(num[i])];
-        else
-            break;
-        if(tmp->prefix)
-            if(!getPrefix(pf, &pnum, num, tmp->prefix, i, false))
-                return NULL;
+    for (size_t start = 0; start < count; start += BATCH_SIZE) {
+        size_t size = count - start < BATCH_SIZE ? count - start : BATCH_SIZE;
+        if (!reverseGroup(pf, nums + start, size, results + start)) {
+            for (size_t k = 0; k < start; k++) { phnumDelete(results[k]); results[k] = NULL; }
+            return false;
+        }
     }
-    return pnum;
+    return true;
 }
 
 
@@ -694,4 +1343,664 @@ PhoneNumbers *phfwdGetReverse(PhoneForward const *pf, char const *num) {
         pnum->arr_length++;
     }
     return pnum;
-}
\ No newline at end of file
+}
+
+/** @brief Porównuje sklejenia napisów
+ * Porównuje leksykograficznie napisy @p a + @p sa oraz @p b + @p sb bez ich
+ * tworzenia.
+ * @param[in] a - początek pierwszego napisu
+ * @param[in] sa - koniec pierwszego napisu
+ * @param[in] b - początek drugiego napisu
+ * @param[in] sb - koniec drugiego napisu
+ * @return -1, 0 lub 1 tak jak strcmp_extended
+ */
+int concatCmp(char const *a, char const *sa, char const *b, char const *sb) {
+    while (true) {
+        if (*a == '\0' && sa != NULL) { a = sa; sa = NULL; continue; }
+        if (*b == '\0' && sb != NULL) { b = sb; sb = NULL; continue; }
+        if (*a != *b) return *a > *b ? 1 : -1;
+        if (*a == '\0') return 0;
+        a++;
+        b++;
+    }
+}
+
+/** @brief Sprawdza, czy napis jest prefiksem numeru
+ *
+ * @param[in] prefix - sprawdzany prefiks
+ * @param[in] num - numer
+ * @return true , jak @p num zaczyna się od @p prefix
+ */
+bool isPrefix(char const *prefix, char const *num) {
+    while (*prefix != '\0' && *prefix == *num) { prefix++; num++; }
+    return *prefix == '\0';
+}
+
+/** @brief Ustawia najmniejszy element strumienia
+ * Lista jest posortowana po samych prefiksach, a porządek sklejeń z końcówką
+ * różni się od niego tylko dla prefiksu i jego przedłużeń, np. "1" < "12",
+ * ale "1" + "5" > "12" + "5". Przedłużenia prefiksu leżą na liście zaraz za
+ * nim, więc element, po którym następuje jego przedłużenie, odkładamy do
+ * @p pending. Element, po którym nie ma przedłużenia, jest mniejszy od
+ * wszystkich dalszych elementów listy, więc najmniejszy element strumienia
+ * to najmniejszy z niego i odłożonych.
+ * @param[in,out] s - strumień
+ * @return false , jak nie udało się alokować pamięci
+ */
+bool streamSettle(stream *s) {
+    if (s->head == NULL && s->list != NULL) {
+        char const *head = s->list->prfx_arr;
+        s->list = s->list->next;
+        while (s->list != NULL && isPrefix(head, s->list->prfx_arr)) {
+            if (s->pending_count == s->pending_size) {
+                size_t size = s->pending_size ? s->pending_size * 2 : 4;
+                char const **bigger = realloc(s->pending, sizeof(char const *) * size);
+                if (bigger == NULL) return false;
+                s->pending = bigger;
+                s->pending_size = size;
+            }
+            s->pending[s->pending_count++] = head;
+            head = s->list->prfx_arr;
+            s->list = s->list->next;
+        }
+        s->head = head;
+    }
+
+    s->top = s->head;
+    s->top_index = s->pending_count;
+    for (size_t i = 0; i < s->pending_count; i++)
+        if (s->top == NULL || concatCmp(s->pending[i], s->suffix, s->top, s->suffix) < 0) {
+            s->top = s->pending[i];
+            s->top_index = i;
+        }
+    return true;
+}
+
+/** @brief Usuwa najmniejszy element strumienia
+ *
+ * @param[in,out] s - strumień
+ * @return false , jak nie udało się alokować pamięci
+ */
+bool streamPop(stream *s) {
+    if (s->top_index == s->pending_count) s->head = NULL;
+    else s->pending[s->top_index] = s->pending[--s->pending_count];
+    return streamSettle(s);
+}
+
+/** @brief Sprawdza, czy numer jest przekierowany na dany numer
+ * Porównuje wynik phfwdGet(x) z @p num bez alokowania wyniku.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów;
+ * @param[in] x - sprawdzany numer
+ * @param[in] num - numer docelowy
+ * @return true , jak phfwdGet(x) = num
+ */
+bool forwardsTo(PhoneForward const *pf, char const *x, char const *num) {
+    descent q;
+    q.num = x;
+    findForwards(pf, &q, 1);
+    if (q.match == NULL) return strcmp_extended(x, num) == 0;
+    return concatCmp(q.match->prefix->prfx_arr, x + q.match_position, num, NULL) == 0;
+}
+
+/** @brief Zwalnia kursor.
+ * @param[in] cur - wskaźnik na usuwany kursor
+ */
+void phcurDelete(PhoneCursor *cur) {
+    if (cur == NULL) return;
+    for (size_t i = 0; i < cur->stream_count; i++)
+        free(cur->streams[i].pending);
+    free(cur->streams);
+    free(cur->buffer);
+    free(cur->num);
+    phfwdDelete(cur->snapshot);
+    free(cur);
+}
+
+/** @brief Tworzy kursor po numerach przekierowanych na dany numer
+ * Schodzi po drzewie prefiksów i z każdego wierzchołka z listą prefiksów
+ * tworzy strumień, który czyta tę listę na miejscu. Numery wynikowe powstają
+ * dopiero przy wydawaniu, więc kursor zajmuje pamięć zależną tylko od
+ * długości numeru i zagnieżdżenia prefiksów na listach. Kursor przechodzi po
+ * migawce struktury, więc późniejsze zmiany @p pf go nie dotyczą, a listy,
+ * które czyta, nie zostaną zmienione ani zwolnione.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów;
+ * @param[in] num - numer
+ * @param[in] after - numer, po którym zaczynamy wydawanie, lub NULL
+ * @param[in] isGet - czy wydajemy tylko numery x, że phfwdGet(x) = num
+ * @return wskaźnik na kursor lub NULL, gdy nie udało się alokować pamięci
+ */
+PhoneCursor *cursorNew(PhoneForward const *pf, char const *num, char const *after, bool isGet) {
+    if (pf == NULL) return NULL;
+    PhoneCursor *cur = calloc(1, sizeof(PhoneCursor));
+    if (cur == NULL) return NULL;
+    cur->snapshot = phfwdSnapshot(pf);
+    if (cur->snapshot == NULL) { free(cur); return NULL; }
+    cur->isGet = isGet;
+    if (!check_num(num)) return cur;
+
+    size_t numlen = strlen(num);
+    cur->num = malloc(sizeof(char) * (numlen + 1));
+    cur->streams = calloc(numlen + 1, sizeof(stream));
+    if (cur->num == NULL || cur->streams == NULL) { phcurDelete(cur); return NULL; }
+    strcpy(cur->num, num);
+
+    cur->self.prfx_arr = cur->num;
+    cur->self.next = NULL;
+    cur->self.parent = NULL;
+    stream *self = &cur->streams[cur->stream_count++];
+    self->list = &cur->self;
+    self->suffix = cur->num + numlen;
+
+    PhoneForward *tmp = cur->snapshot->child[1];
+    for (size_t i = 0; i < numlen; i++) {
+        tmp = tmp->child[get_digit(num[i])];
+        if (tmp == NULL) break;
+        if (tmp->prefix == NULL) continue;
+
+        stream *s = &cur->streams[cur->stream_count++];
+        s->list = tmp->prefix;
+        s->suffix = cur->num + i + 1;
+    }
+
+    bool seek = check_num(after);
+    for (size_t i = 0; i < cur->stream_count; i++) {
+        stream *s = &cur->streams[i];
+        bool ok = streamSettle(s);
+        while (ok && seek && s->top != NULL && concatCmp(s->top, s->suffix, after, NULL) <= 0)
+            ok = streamPop(s);
+        if (!ok) { phcurDelete(cur); return NULL; }
+    }
+    return cur;
+}
+
+/** @brief Tworzy kursor po wyniku phfwdReverse.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów;
+ * @param[in] num - numer
+ * @param[in] after - numer, po którym zaczynamy wydawanie, lub NULL
+ * @return wskaźnik na kursor lub NULL, gdy nie udało się alokować pamięci
+ */
+PhoneCursor *phfwdReverseCursor(PhoneForward const *pf, char const *num, char const *after) {
+    return cursorNew(pf, num, after, false);
+}
+
+/** @brief Tworzy kursor po wyniku phfwdGetReverse.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów;
+ * @param[in] num - numer
+ * @param[in] after - numer, po którym zaczynamy wydawanie, lub NULL
+ * @return wskaźnik na kursor lub NULL, gdy nie udało się alokować pamięci
+ */
+PhoneCursor *phfwdGetReverseCursor(PhoneForward const *pf, char const *num, char const *after) {
+    return cursorNew(pf, num, after, true);
+}
+
+/** @brief Wydaje kolejny numer
+ * Scala strumienie: wybiera najmniejszy z ich pierwszych elementów, pomijając
+ * powtórzenia oraz, dla phfwdGetReverse, numery przekierowane gdzie indziej.
+ * @param[in,out] cur - kursor
+ * @return wskaźnik na numer ważny do następnego wywołania lub NULL, gdy
+ *         numery się skończyły lub nie udało się alokować pamięci
+ */
+char const *phcurNext(PhoneCursor *cur) {
+    if (cur == NULL || cur->failed) return NULL;
+    while (true) {
+        stream *best = NULL;
+        for (size_t i = 0; i < cur->stream_count; i++) {
+            stream *s = &cur->streams[i];
+            if (s->top == NULL) continue;
+            if (best == NULL || concatCmp(s->top, s->suffix, best->top, best->suffix) < 0)
+                best = s;
+        }
+        if (best == NULL) return NULL;
+
+        char const *item = best->top;
+        if (cur->started && concatCmp(item, best->suffix, cur->buffer, NULL) == 0) {
+            if (!streamPop(best)) { cur->failed = true; return NULL; }
+            continue;
+        }
+
+        size_t length = strlen(item) + strlen(best->suffix) + 1;
+        if (length > cur->buffer_size) {
+            char *bigger = realloc(cur->buffer, sizeof(char) * length * 2);
+            if (bigger == NULL) { cur->failed = true; return NULL; }
+            cur->buffer = bigger;
+            cur->buffer_size = length * 2;
+        }
+        strcpy(cur->buffer, item);
+        strcat(cur->buffer, best->suffix);
+        cur->started = true;
+        if (!streamPop(best)) { cur->failed = true; return NULL; }
+
+        if (cur->isGet && !forwardsTo(cur->snapshot, cur->buffer, cur->num)) continue;
+        return cur->buffer;
+    }
+}
+
+/** @brief Sprawdza, czy w kursorze wystąpił błąd.
+ * @param[in] cur - kursor
+ * @return true , jak nie udało się alokować pamięci
+ */
+bool phcurFailed(PhoneCursor const *cur) {
+    return cur != NULL && cur->failed;
+}
+
+/** @brief Wydaje stronę numerów
+ * @param[in,out] cur - kursor
+ * @param[in] limit - największa liczba numerów na stronie
+ * @return Wskaźnik na strukturę przechowującą ciąg co najwyżej @p limit
+ *         kolejnych numerów lub NULL, gdy nie udało się alokować pamięci.
+ */
+PhoneNumbers *phcurPage(PhoneCursor *cur, size_t limit) {
+    if (cur == NULL) return NULL;
+    PhoneNumbers *pnum = emptyNumbers();
+    if (pnum == NULL) return NULL;
+
+    node *last = NULL;
+    for (size_t i = 0; i < limit; i++) {
+        char const *number = phcurNext(cur);
+        if (number == NULL) {
+            if (cur->failed) { phnumDelete(pnum); return NULL; }
+            break;
+        }
+
+        node *item = malloc(sizeof(node));
+        if (item == NULL) { phnumDelete(pnum); return NULL; }
+        item->prfx_arr = malloc(sizeof(char) * (strlen(number) + 1));
+        if (item->prfx_arr == NULL) { free(item); phnumDelete(pnum); return NULL; }
+        strcpy(item->prfx_arr, number);
+        item->next = NULL;
+        item->parent = last;
+        if (last) last->next = item;
+        else pnum->numbers = item;
+        last = item;
+        pnum->arr_length++;
+    }
+    return pnum;
+}
+
+/** @brief Wybiera miejsce w tablicy zapamiętanych łańcuchów
+ *
+ * @param[in] num - numer początkowy
+ * @param[in] max_hops - limit kroków
+ * @return indeks miejsca
+ */
+size_t memoSlot(char const *num, size_t max_hops) {
+    size_t hash = max_hops;
+    for (size_t i = 0; num[i] != '\0'; i++)
+        hash = hash * 31 + (size_t) get_digit(num[i]);
+    return hash % MEMO_SIZE;
+}
+
+/** @brief Zapamiętuje łańcuch w korzeniu struktury
+ * Jeśli nie uda się alokować pamięci, łańcuch po prostu nie jest zapamiętany.
+ * @param[in,out] pf - korzeń struktury
+ * @param[in] num - numer początkowy
+ * @param[in] result - ostatni numer łańcucha
+ * @param[in] max_hops - limit kroków
+ * @param[in] status - sposób zakończenia łańcucha
+ */
+void memoStore(root *pf, char const *num, char const *result, size_t max_hops,
+               PhoneChainStatus status) {
+    if (pf->memo == NULL) {
+        pf->memo = calloc(MEMO_SIZE, sizeof(memo));
+        if (pf->memo == NULL) return;
+    }
+    memo *m = &pf->memo[memoSlot(num, max_hops)];
+    free(m->num);
+    free(m->result);
+    m->num = copyNumber(num);
+    m->result = copyNumber(result);
+    if (m->num == NULL || m->result == NULL) {
+        free(m->num);
+        free(m->result);
+        m->num = m->result = NULL;
+        return;
+    }
+    m->max_hops = max_hops;
+    m->status = status;
+    m->version = pf->version;
+}
+
+/** @brief Wyznacza koniec łańcucha przekierowań.
+ * Przekierowuje numer tak długo, aż nie jest on dalej przekierowany, łańcuch
+ * wróci do odwiedzonego numeru lub wykona się @p max_hops kroków. Wyniki dla
+ * przekierowanych numerów są zapamiętywane w tablicy w korzeniu @p pf, pod
+ * miejscem wybranym przez numer i limit kroków, i są aktualne do najbliższej
+ * zmiany struktury. Korzeń nie jest współdzielony z migawkami, więc
+ * zapamiętywanie nie zmienia ich wierzchołków.
+ * @param[in,out] pf – wskaźnik na strukturę przechowującą przekierowania numerów;
+ * @param[in] num – wskaźnik na napis reprezentujący numer.
+ * @param[in] max_hops – największa liczba kroków
+ * @param[out] status – sposób zakończenia łańcucha
+ * @return Wskaźnik na strukturę przechowującą ciąg numerów lub NULL, gdy nie
+ *         udało się alokować pamięci.
+ */
+PhoneNumbers *phfwdResolve(PhoneForward *pf, char const *num, size_t max_hops, PhoneChainStatus *status) {
+    if (pf == NULL) return NULL;
+    PhoneChainStatus ignored;
+    if (status == NULL) status = &ignored;
+    *status = PHFWD_CHAIN_END;
+    if (!check_num(num)) return emptyNumbers();
+
+    descent q;
+    q.num = num;
+    findForwards(pf, &q, 1);
+    if (q.match == NULL) return singleNumber(copyNumber(num));
+
+    root *record = (root *) pf;
+    memo *m = record->memo ? &record->memo[memoSlot(num, max_hops)] : NULL;
+    if (m && m->num && m->version == record->version && m->max_hops == max_hops && strcmp(m->num, num) == 0) {
+        *status = m->status;
+        return singleNumber(copyNumber(m->result));
+    }
+
+    size_t length = 0, capacity = 4;
+    char **chain = malloc(sizeof(char *) * capacity);
+    if (chain == NULL) return NULL;
+    chain[length] = copyNumber(num);
+    if (chain[length++] == NULL) { free(chain); return NULL; }
+
+    bool ok = true;
+    while (q.match != NULL) {
+        if (length - 1 == max_hops) { *status = PHFWD_CHAIN_LIMIT; break; }
+
+        char *next = Forward(q.match_position, q.match->prefix->prfx_arr, q.num);
+        if (next == NULL) { ok = false; break; }
+        bool seen = false;
+        for (size_t i = 0; i < length && !seen; i++)
+            seen = strcmp(chain[i], next) == 0;
+        if (seen) { free(next); *status = PHFWD_CHAIN_CYCLE; break; }
+
+        if (length == capacity) {
+            char **bigger = realloc(chain, sizeof(char *) * capacity * 2);
+            if (bigger == NULL) { free(next); ok = false; break; }
+            chain = bigger;
+            capacity *= 2;
+        }
+        chain[length++] = next;
+        q.num = next;
+        findForwards(pf, &q, 1);
+    }
+
+    char *result = ok ? chain[length - 1] : NULL;
+    for (size_t i = 0; i + 1 < length; i++)
+        free(chain[i]);
+    if (!ok) free(chain[length - 1]);
+    free(chain);
+    if (!ok) return NULL;
+
+    memoStore(record, num, result, max_hops, *status);
+    return singleNumber(result);
+}
+
+/** @brief Usuwa iterator.
+ * @param[in] it - wskaźnik na usuwany iterator
+ */
+void phfwdIterDelete(PhoneForwardIter *it) {
+    if (it == NULL) return;
+    phfwdDelete(it->snapshot);
+    free(it->stack);
+    free(it->next);
+    free(it->path);
+    free(it);
+}
+
+/** @brief Powiększa tablice iteratora
+ *
+ * @param[in,out] it - iterator
+ * @return false , jak nie udało się alokować pamięci
+ */
+bool iterGrow(PhoneForwardIter *it) {
+    size_t capacity = it->capacity * 2;
+    PhoneForward const **stack = realloc(it->stack, sizeof(PhoneForward const *) * capacity);
+    if (stack == NULL) return false;
+    it->stack = stack;
+    int *next = realloc(it->next, sizeof(int) * capacity);
+    if (next == NULL) return false;
+    it->next = next;
+    char *path = realloc(it->path, sizeof(char) * capacity);
+    if (path == NULL) return false;
+    it->path = path;
+    it->capacity = capacity;
+    return true;
+}
+
+/** @brief Tworzy iterator po przekierowaniach.
+ * Iterator przechodzi po migawce struktury, więc późniejsze zmiany @p pf go
+ * nie dotyczą.
+ * @param[in] pf - wskaźnik na strukturę przechowującą przekierowania numerów;
+ * @return wskaźnik na iterator lub NULL, gdy nie udało się alokować pamięci
+ */
+PhoneForwardIter *phfwdIterNew(PhoneForward const *pf) {
+    if (pf == NULL) return NULL;
+    PhoneForwardIter *it = calloc(1, sizeof(PhoneForwardIter));
+    if (it == NULL) return NULL;
+
+    it->capacity = 16;
+    it->snapshot = phfwdSnapshot(pf);
+    it->stack = malloc(sizeof(PhoneForward const *) * it->capacity);
+    it->next = malloc(sizeof(int) * it->capacity);
+    it->path = malloc(sizeof(char) * it->capacity);
+    if (it->snapshot == NULL || it->stack == NULL || it->next == NULL || it->path == NULL) {
+        phfwdIterDelete(it);
+        return NULL;
+    }
+    it->stack[0] = it->snapshot->child[0];
+    it->next[0] = -1;
+    it->depth = 0;
+    return it;
+}
+
+/** @brief Wydaje kolejne przekierowanie
+ * Przechodzi drzewo numerów w głąb bez rekurencji, wierzchołek przed jego
+ * synami, synów w kolejności cyfr 0-9, *, #.
+ * @param[in,out] it - iterator
+ * @param[out] num1 - prefiks przekierowywany
+ * @param[out] num2 - prefiks, na który jest przekierowanie
+ * @return true , jak wydano przekierowanie; false - jak się skończyły lub nie
+ *         udało się alokować pamięci, wtedy ustawia @p failed
+ */
+bool phfwdIterNext(PhoneForwardIter *it, char const **num1, char const **num2) {
+    if (it == NULL || it->failed) return false;
+    while (true) {
+        PhoneForward const *top = it->stack[it->depth];
+        if (it->next[it->depth] == -1) {
+            it->next[it->depth] = 0;
+            if (top->prefix != NULL && it->depth > 0) {
+                it->path[it->depth] = '\0';
+                *num1 = it->path;
+                *num2 = top->prefix->prfx_arr;
+                return true;
+            }
+        }
+
+        int digit = it->next[it->depth];
+        while (digit < SIZE && top->child[digit] == NULL) digit++;
+        if (digit == SIZE) {
+            it->next[it->depth] = SIZE;
+            if (it->depth == 0) return false;
+            it->depth--;
+            continue;
+        }
+
+        it->next[it->depth] = digit + 1;
+        if (it->depth + 2 >= it->capacity && !iterGrow(it)) {
+            it->failed = true;
+            return false;
+        }
+        it->path[it->depth] = get_char(digit);
+        it->depth++;
+        it->stack[it->depth] = top->child[digit];
+        it->next[it->depth] = -1;
+    }
+}
+
+/** @brief Sprawdza, czy w iteratorze wystąpił błąd.
+ * @param[in] it - iterator
+ * @return true , jak nie udało się alokować pamięci
+ */
+bool phfwdIterFailed(PhoneForwardIter const *it) {
+    return it != NULL && it->failed;
+}
+
+/** @brief Usuwa porównanie.
+ * @param[in] diff - wskaźnik na usuwane porównanie
+ */
+void phfwdDiffDelete(PhoneForwardDiff *diff) {
+    if (diff == NULL) return;
+    phfwdDelete(diff->from);
+    phfwdDelete(diff->to);
+    free(diff->from_stack);
+    free(diff->to_stack);
+    free(diff->next);
+    free(diff->path);
+    free(diff);
+}
+
+/** @brief Powiększa tablice porównania
+ *
+ * @param[in,out] diff - porównanie
+ * @return false , jak nie udało się alokować pamięci
+ */
+bool diffGrow(PhoneForwardDiff *diff) {
+    size_t capacity = diff->capacity * 2;
+    PhoneForward const **from_stack = realloc(diff->from_stack, sizeof(PhoneForward const *) * capacity);
+    if (from_stack == NULL) return false;
+    diff->from_stack = from_stack;
+    PhoneForward const **to_stack = realloc(diff->to_stack, sizeof(PhoneForward const *) * capacity);
+    if (to_stack == NULL) return false;
+    diff->to_stack = to_stack;
+    int *next = realloc(diff->next, sizeof(int) * capacity);
+    if (next == NULL) return false;
+    diff->next = next;
+    char *path = realloc(diff->path, sizeof(char) * capacity);
+    if (path == NULL) return false;
+    diff->path = path;
+    diff->capacity = capacity;
+    return true;
+}
+
+/** @brief Tworzy porównanie dwóch struktur.
+ * @param[in] from - struktura źródłowa
+ * @param[in] to - struktura docelowa
+ * @return wskaźnik na porównanie lub NULL, gdy nie udało się alokować pamięci
+ */
+PhoneForwardDiff *phfwdDiffNew(PhoneForward const *from, PhoneForward const *to) {
+    if (from == NULL || to == NULL) return NULL;
+    PhoneForwardDiff *diff = calloc(1, sizeof(PhoneForwardDiff));
+    if (diff == NULL) return NULL;
+
+    diff->capacity = 16;
+    diff->from = phfwdSnapshot(from);
+    diff->to = phfwdSnapshot(to);
+    diff->from_stack = malloc(sizeof(PhoneForward const *) * diff->capacity);
+    diff->to_stack = malloc(sizeof(PhoneForward const *) * diff->capacity);
+    diff->next = malloc(sizeof(int) * diff->capacity);
+    diff->path = malloc(sizeof(char) * diff->capacity);
+    if (diff->from == NULL || diff->to == NULL || diff->from_stack == NULL ||
+        diff->to_stack == NULL || diff->next == NULL || diff->path == NULL) {
+        phfwdDiffDelete(diff);
+        return NULL;
+    }
+    diff->from_stack[0] = diff->from->child[0];
+    diff->to_stack[0] = diff->to->child[0];
+    diff->next[0] = -1;
+    diff->depth = 0;
+    return diff;
+}
+
+/** @brief Sprawdza, czy poddrzewo nie ma przekierowań
+ *
+ * @param[in] vertex - wierzchołek drzewa numerów lub NULL
+ * @return true , jak w poddrzewie nie ma żadnego przekierowania
+ */
+bool subtreeEmpty(PhoneForward const *vertex) {
+    return vertex == NULL || vertex->fwd_count == 0;
+}
+
+/** @brief Zwraca syna wierzchołka
+ *
+ * @param[in] vertex - wierzchołek lub NULL
+ * @param[in] digit - cyfra syna
+ * @return wskaznik na syna lub NULL, gdy wierzchołka albo syna nie ma
+ */
+PhoneForward const *childOf(PhoneForward const *vertex, int digit) {
+    return vertex == NULL ? NULL : vertex->child[digit];
+}
+
+/** @brief Wydaje kolejną operację
+ * Przechodzi oba drzewa numerów jednocześnie, w głąb bez rekurencji. Para
+ * tych samych wierzchołków albo poddrzew bez przekierowań jest pomijana bez
+ * schodzenia niżej, więc koszt zależy od liczby zmienionych wierzchołków.
+ * Jeśli cel nie ma przekierowań w poddrzewie, poddrzewo jest usuwane jedną
+ * operacją. Jeśli cel nie ma przekierowania samego numeru, który źródło ma,
+ * poddrzewo też jest usuwane, a przekierowania celu z niego są dodawane
+ * ponownie. Przekierowanie celu, którego nie ma w źródle lub które ma inny
+ * prefiks docelowy, daje dodanie.
+ * @param[in,out] diff - porównanie
+ * @param[out] add - true dla dodania, false dla usunięcia
+ * @param[out] num1 - prefiks przekierowywany lub usuwany
+ * @param[out] num2 - prefiks docelowy przy dodaniu, NULL przy usunięciu
+ * @return true , jak wydano operację; false - jak się skończyły lub nie
+ *         udało się alokować pamięci, wtedy ustawia @p failed
+ */
+bool phfwdDiffNext(PhoneForwardDiff *diff, bool *add, char const **num1, char const **num2) {
+    if (diff == NULL || diff->failed) return false;
+    while (true) {
+        size_t depth = diff->depth;
+        PhoneForward const *a = diff->from_stack[depth], *b = diff->to_stack[depth];
+        if (diff->next[depth] == -1) {
+            diff->next[depth] = 0;
+            if (depth > 0) {
+                diff->path[depth] = '\0';
+                *num1 = diff->path;
+                if (subtreeEmpty(b)) {
+                    diff->next[depth] = SIZE;
+                    *add = false; *num2 = NULL;
+                    return true;
+                }
+                node const *ra = a == NULL ? NULL : a->prefix, *rb = b->prefix;
+                if (ra != NULL && rb == NULL) {
+                    diff->from_stack[depth] = NULL;
+                    *add = false; *num2 = NULL;
+                    return true;
+                }
+                if (rb != NULL && (ra == NULL || strcmp_extended(ra->prfx_arr, rb->prfx_arr) != 0)) {
+                    *add = true; *num2 = rb->prfx_arr;
+                    return true;
+                }
+            }
+        }
+
+        int digit = diff->next[depth];
+        while (digit < SIZE) {
+            PhoneForward const *x = childOf(a, digit), *y = childOf(b, digit);
+            if (x != y && !(subtreeEmpty(x) && subtreeEmpty(y))) break;
+            digit++;
+        }
+        if (digit == SIZE) {
+            diff->next[depth] = SIZE;
+            if (depth == 0) return false;
+            diff->depth--;
+            continue;
+        }
+
+        diff->next[depth] = digit + 1;
+        if (depth + 2 >= diff->capacity && !diffGrow(diff)) {
+            diff->failed = true;
+            return false;
+        }
+        diff->path[depth] = get_char(digit);
+        diff->depth++;
+        diff->from_stack[depth + 1] = childOf(a, digit);
+        diff->to_stack[depth + 1] = childOf(b, digit);
+        diff->next[depth + 1] = -1;
+    }
+}
+
+/** @brief Sprawdza, czy w porównaniu wystąpił błąd.
+ * @param[in] diff - porównanie
+ * @return true , jak nie udało się alokować pamięci
+ */
+bool phfwdDiffFailed(PhoneForwardDiff const *diff) {
+    return diff != NULL && diff->failed;
+}
@@ -24,6 +24,34 @@ typedef struct PhoneForward PhoneForward;
 struct PhoneNumbers;
 typedef struct PhoneNumbers PhoneNumbers;
 
+/**
+ * To jest struktura iteratora po wszystkich przekierowaniach.
+ */
+struct PhoneForwardIter;
+typedef struct PhoneForwardIter PhoneForwardIter;
+
+/**
+ * To jest struktura wyznaczająca operacje zamieniające jedną strukturę
+ * przekierowań w drugą.
+ */
+struct PhoneForwardDiff;
+typedef struct PhoneForwardDiff PhoneForwardDiff;
+
+/**
+ * To jest sposób zakończenia łańcucha przekierowań.
+ */
+typedef enum PhoneChainStatus {
+    PHFWD_CHAIN_END,   /**< ostatni numer nie jest dalej przekierowany */
+    PHFWD_CHAIN_CYCLE, /**< następny numer był już w łańcuchu */
+    PHFWD_CHAIN_LIMIT  /**< wykonano największą dozwoloną liczbę kroków */
+} PhoneChainStatus;
+
+/**
+ * To jest struktura kursora wydającego kolejno wyniki odwracania przekierowań.
+ */
+struct PhoneCursor;
+typedef struct PhoneCursor PhoneCursor;
+
 /** @brief Tworzy nową strukturę.
  * Tworzy nową strukturę niezawierającą żadnych przekierowań.
  * @return Wskaźnik na utworzoną strukturę lub NULL, gdy nie udało się
@@ -38,6 +66,21 @@ PhoneForward * phfwdNew(void);
  */
 void phfwdDelete(PhoneForward *pf);
 
+/** @brief Tworzy migawkę struktury.
+ * Tworzy w czasie stałym nową strukturę o tej samej zawartości co @p pf.
+ * Obie struktury współdzielą wierzchołki, a zmiana jednej z nich kopiuje tylko
+ * wierzchołki na zmienianych ścieżkach, więc druga widzi niezmienioną
+ * zawartość. Migawkę można czytać i zmieniać jak każdą inną strukturę; musi
+ * być zwolniona za pomocą funkcji @ref phfwdDelete. Wierzchołki są zwalniane,
+ * gdy nie wskazuje na nie żadna struktura. Migawkę trzeba utworzyć w wątku,
+ * który zmienia @p pf, albo pod tą samą blokadą co zmiany; potem migawkę i
+ * @p pf można czytać, zmieniać i zwalniać w różnych wątkach bez blokad.
+ * @param[in] pf – wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @return Wskaźnik na utworzoną strukturę lub NULL, gdy @p pf ma wartość NULL
+ *         lub nie udało się alokować pamięci.
+ */
+PhoneForward * phfwdSnapshot(PhoneForward const *pf);
+
 /** @brief Dodaje przekierowanie.
  * Dodaje przekierowanie wszystkich numerów mających prefiks @p num1, na numery,
  * w których ten prefiks zamieniono odpowiednio na prefiks @p num2. Każdy numer
@@ -96,6 +139,70 @@ PhoneNumbers * phfwdGet(PhoneForward const *pf, char const *num);
  */
 PhoneNumbers * phfwdReverse(PhoneForward const *pf, char const *num);
 
+/** @brief Sprawdza, czy numer jest przekierowany.
+ * Odpowiada na pytanie, czy @ref phfwdGet zwróciłoby inny numer niż @p num,
+ * ale nie alokuje pamięci.
+ * @param[in] pf  – wskaźnik na strukturę przechowującą przekierowania numerów;
+ * @param[in] num – wskaźnik na napis reprezentujący numer.
+ * @return Wartość @p true, jeśli któryś prefiks numeru jest przekierowany.
+ *         Wartość @p false, jeśli nie jest, @p pf ma wartość NULL lub @p num
+ *         nie reprezentuje numeru.
+ */
+bool phfwdIsForwarded(PhoneForward const *pf, char const *num);
+
+/** @brief Wyznacza przekierowanie numeru do bufora.
+ * Działa jak @ref phfwdGet, ale nie alokuje pamięci: wynik jest zapisywany w
+ * buforze @p buffer jak w funkcji snprintf. Zapisywanych jest co najwyżej
+ * @p size - 1 znaków wyniku, a napis jest zawsze kończony zerem, jeśli
+ * @p size jest dodatnie. Wynik jest obcięty, gdy wartość zwracana nie jest
+ * mniejsza niż @p size.
+ * @param[in] pf      – wskaźnik na strukturę przechowującą przekierowania
+ *                      numerów;
+ * @param[in] num     – wskaźnik na napis reprezentujący numer;
+ * @param[out] buffer – wskaźnik na bufor, może mieć wartość NULL, gdy @p size
+ *                      jest zerem;
+ * @param[in] size    – rozmiar bufora.
+ * @return Długość całego wyniku bez kończącego zera. Wartość 0, jeśli @p pf ma
+ *         wartość NULL lub @p num nie reprezentuje numeru.
+ */
+size_t phfwdGetInto(PhoneForward const *pf, char const *num, char *buffer,
+                    size_t size);
+
+/** @brief Wyznacza przekierowania grupy numerów.
+ * Działa jak wywołanie @ref phfwdGet dla każdego z numerów @p nums, ale
+ * zejścia po drzewie dla kilku numerów są przeplatane ze sobą, dzięki czemu
+ * oczekiwania na pamięć dla różnych numerów nakładają się. Wynik dla numeru
+ * @p nums[i] jest zapisywany w @p results[i] i musi być zwolniony za pomocą
+ * funkcji @ref phnumDelete.
+ * @param[in] pf       – wskaźnik na strukturę przechowującą przekierowania
+ *                       numerów;
+ * @param[in] nums     – tablica wskaźników na napisy reprezentujące numery;
+ * @param[in] count    – liczba numerów;
+ * @param[out] results – tablica o rozmiarze @p count na wyniki.
+ * @return Wartość @p true, jeśli wyznaczono wszystkie wyniki. Wartość
+ *         @p false, jeśli któryś z argumentów ma wartość NULL lub nie udało się
+ *         alokować pamięci – wtedy w @p results nie zostaje żaden wynik.
+ */
+bool phfwdGetBatch(PhoneForward const *pf, char const * const *nums,
+                   size_t count, PhoneNumbers **results);
+
+/** @brief Wyznacza przekierowania na grupę numerów.
+ * Działa jak wywołanie @ref phfwdReverse dla każdego z numerów @p nums, ale
+ * zejścia po drzewie dla kilku numerów są przeplatane ze sobą. Wynik dla
+ * numeru @p nums[i] jest zapisywany w @p results[i] i musi być zwolniony za
+ * pomocą funkcji @ref phnumDelete.
+ * @param[in] pf       – wskaźnik na strukturę przechowującą przekierowania
+ *                       numerów;
+ * @param[in] nums     – tablica wskaźników na napisy reprezentujące numery;
+ * @param[in] count    – liczba numerów;
+ * @param[out] results – tablica o rozmiarze @p count na wyniki.
+ * @return Wartość @p true, jeśli wyznaczono wszystkie wyniki. Wartość
+ *         @p false, jeśli któryś z argumentów ma wartość NULL lub nie udało się
+ *         alokować pamięci – wtedy w @p results nie zostaje żaden wynik.
+ */
+bool phfwdReverseBatch(PhoneForward const *pf, char const * const *nums,
+                       size_t count, PhoneNumbers **results);
+
 /** @brief Usuwa strukturę.
  * Usuwa strukturę wskazywaną przez @p pnum. Nic nie robi, jeśli wskaźnik ten ma
  * wartość NULL.
@@ -123,4 +230,191 @@ char const * phnumGet(PhoneNumbers const *pnum, size_t idx);
  */
 PhoneNumbers * phfwdGetReverse(PhoneForward const *pf, char const *num);
 
+/** @brief Tworzy kursor po wyniku @ref phfwdReverse.
+ * Tworzy kursor, który wydaje kolejno, w porządku leksykograficznym, numery z
+ * wyniku wywołania @ref phfwdReverse z numerem @p num, większe od numeru
+ * @p after. Numery są wyznaczane dopiero przy wydawaniu, więc można przerwać
+ * przeglądanie w dowolnym momencie, a kursor czyta listy struktury na miejscu
+ * i nie kopiuje wyników. Jeśli @p after nie reprezentuje numeru,
+ * kursor zaczyna od najmniejszego numeru. Kursor działa na migawce struktury,
+ * więc późniejsze zmiany @p pf go nie dotyczą. Kursor musi być zwolniony za
+ * pomocą funkcji @ref phcurDelete.
+ * @param[in] pf    – wskaźnik na strukturę przechowującą przekierowania
+ *                    numerów;
+ * @param[in] num   – wskaźnik na napis reprezentujący numer;
+ * @param[in] after – wskaźnik na napis reprezentujący numer, po którym
+ *                    zaczyna się wydawanie, lub NULL.
+ * @return Wskaźnik na kursor lub NULL, gdy @p pf ma wartość NULL lub nie
+ *         udało się alokować pamięci.
+ */
+PhoneCursor * phfwdReverseCursor(PhoneForward const *pf, char const *num,
+                                 char const *after);
+
+/** @brief Tworzy kursor po wyniku @ref phfwdGetReverse.
+ * Działa jak @ref phfwdReverseCursor, ale wydaje tylko numery z wyniku
+ * wywołania @ref phfwdGetReverse.
+ * @param[in] pf    – wskaźnik na strukturę przechowującą przekierowania
+ *                    numerów;
+ * @param[in] num   – wskaźnik na napis reprezentujący numer;
+ * @param[in] after – wskaźnik na napis reprezentujący numer, po którym
+ *                    zaczyna się wydawanie, lub NULL.
+ * @return Wskaźnik na kursor lub NULL, gdy @p pf ma wartość NULL lub nie
+ *         udało się alokować pamięci.
+ */
+PhoneCursor * phfwdGetReverseCursor(PhoneForward const *pf, char const *num,
+                                    char const *after);
+
+/** @brief Wydaje kolejny numer.
+ * Po wyniku NULL funkcja @ref phcurFailed odróżnia koniec numerów od braku
+ * pamięci. Po błędzie kursor nie wydaje już żadnych numerów.
+ * @param[in,out] cur – wskaźnik na kursor.
+ * @return Wskaźnik na napis reprezentujący numer, ważny do następnego wywołania
+ *         funkcji na tym kursorze. Wartość NULL, jeśli numery się skończyły,
+ *         @p cur ma wartość NULL lub nie udało się alokować pamięci.
+ */
+char const * phcurNext(PhoneCursor *cur);
+
+/** @brief Sprawdza, czy w kursorze wystąpił błąd.
+ * @param[in] cur – wskaźnik na kursor.
+ * @return Wartość @p true, jeśli kursor przestał wydawać numery, bo nie udało
+ *         się alokować pamięci. Wartość @p false w przeciwnym przypadku lub
+ *         gdy @p cur ma wartość NULL.
+ */
+bool phcurFailed(PhoneCursor const *cur);
+
+/** @brief Wydaje stronę numerów.
+ * Wydaje co najwyżej @p limit kolejnych numerów. Pusty ciąg oznacza, że numery
+ * się skończyły. Alokuje strukturę @p PhoneNumbers, która musi być zwolniona
+ * za pomocą funkcji @ref phnumDelete.
+ * @param[in,out] cur – wskaźnik na kursor;
+ * @param[in] limit   – największa liczba numerów na stronie.
+ * @return Wskaźnik na strukturę przechowującą ciąg numerów lub NULL, gdy
+ *         @p cur ma wartość NULL lub nie udało się alokować pamięci.
+ */
+PhoneNumbers * phcurPage(PhoneCursor *cur, size_t limit);
+
+/** @brief Usuwa kursor.
+ * Usuwa kursor wskazywany przez @p cur. Nic nie robi, jeśli wskaźnik ten ma
+ * wartość NULL.
+ * @param[in] cur – wskaźnik na usuwany kursor.
+ */
+void phcurDelete(PhoneCursor *cur);
+
+/** @brief Wyznacza koniec łańcucha przekierowań.
+ * Przekierowuje numer @p num tak jak @ref phfwdGet, potem przekierowuje wynik
+ * i tak dalej, aż otrzymany numer nie jest dalej przekierowany, następny numer
+ * był już w łańcuchu lub wykonano @p max_hops kroków. Wynikiem jest ciąg
+ * zawierający ostatni numer łańcucha. Ostatnie wyniki dla przekierowanych
+ * numerów są zapamiętywane w niewielkiej tablicy w @p pf, więc ponowne
+ * wyznaczenie łańcucha dla popularnego numeru zwykle kosztuje jedno zejście po
+ * drzewie, dopóki struktura nie zostanie zmieniona funkcją @ref phfwdAdd lub
+ * @ref phfwdRemove. Funkcja zmienia tylko tę tablicę, a nie wierzchołki
+ * współdzielone z migawkami. Jeśli podany napis nie reprezentuje
+ * numeru, wynikiem jest pusty ciąg. Alokuje strukturę @p PhoneNumbers, która
+ * musi być zwolniona za pomocą funkcji @ref phnumDelete.
+ * @param[in,out] pf – wskaźnik na strukturę przechowującą przekierowania
+ *                     numerów;
+ * @param[in] num      – wskaźnik na napis reprezentujący numer;
+ * @param[in] max_hops – największa liczba kroków;
+ * @param[out] status  – wskaźnik, pod którym zostanie zapisany sposób
+ *                       zakończenia łańcucha, lub NULL.
+ * @return Wskaźnik na strukturę przechowującą ciąg numerów lub NULL, gdy
+ *         @p pf ma wartość NULL lub nie udało się alokować pamięci.
+ */
+PhoneNumbers * phfwdResolve(PhoneForward *pf, char const *num, size_t max_hops,
+                            PhoneChainStatus *status);
+
+/** @brief Tworzy iterator po przekierowaniach.
+ * Tworzy iterator, który wydaje wszystkie pary (@p num1, @p num2) dodane
+ * funkcją @ref phfwdAdd i nieusunięte. Przekierowania są wydawane w kolejności
+ * prefiksów @p num1, przy czym numer jest przed swoimi przedłużeniami, a cyfry
+ * są uporządkowane 0, 1, …, 9, *, #. Iterator działa na migawce struktury,
+ * więc późniejsze zmiany @p pf go nie dotyczą. Iterator musi być zwolniony za
+ * pomocą funkcji @ref phfwdIterDelete.
+ * @param[in] pf – wskaźnik na strukturę przechowującą przekierowania numerów.
+ * @return Wskaźnik na iterator lub NULL, gdy @p pf ma wartość NULL lub nie
+ *         udało się alokować pamięci.
+ */
+PhoneForwardIter * phfwdIterNew(PhoneForward const *pf);
+
+/** @brief Wydaje kolejne przekierowanie.
+ * Napisy są ważne do następnego wywołania funkcji na tym iteratorze. Po
+ * wyniku @p false funkcja @ref phfwdIterFailed odróżnia koniec przekierowań od
+ * braku pamięci. Po błędzie iterator nie wydaje już żadnych przekierowań.
+ * @param[in,out] it – wskaźnik na iterator;
+ * @param[out] num1  – wskaźnik, pod którym zostanie zapisany prefiks numerów
+ *                     przekierowywanych;
+ * @param[out] num2  – wskaźnik, pod którym zostanie zapisany prefiks numerów,
+ *                     na które jest wykonywane przekierowanie.
+ * @return Wartość @p true, jeśli wydano przekierowanie. Wartość @p false, jeśli
+ *         przekierowania się skończyły, @p it ma wartość NULL lub nie udało się
+ *         alokować pamięci.
+ */
+bool phfwdIterNext(PhoneForwardIter *it, char const **num1, char const **num2);
+
+/** @brief Sprawdza, czy w iteratorze wystąpił błąd.
+ * @param[in] it – wskaźnik na iterator.
+ * @return Wartość @p true, jeśli iterator przestał wydawać przekierowania, bo
+ *         nie udało się alokować pamięci. Wartość @p false w przeciwnym
+ *         przypadku lub gdy @p it ma wartość NULL.
+ */
+bool phfwdIterFailed(PhoneForwardIter const *it);
+
+/** @brief Usuwa iterator.
+ * Nic nie robi, jeśli wskaźnik @p it ma wartość NULL.
+ * @param[in] it – wskaźnik na usuwany iterator.
+ */
+void phfwdIterDelete(PhoneForwardIter *it);
+
+/** @brief Tworzy porównanie dwóch struktur.
+ * Tworzy obiekt, który wydaje kolejno operacje @ref phfwdAdd i
+ * @ref phfwdRemove zamieniające zawartość @p from w zawartość @p to. Obie
+ * struktury są przeglądane jednocześnie, a poddrzewa współdzielone przez
+ * migawki są pomijane bez przeglądania, więc dla migawki i jej oryginału koszt
+ * zależy od liczby zmienionych przekierowań, a nie od rozmiaru struktur.
+ * Usunięcia dotyczą najkrótszych prefiksów, pod którymi @p to nie ma
+ * przekierowań. Obie struktury są porównywane w postaci z chwili utworzenia
+ * porównania.
+ * Porównanie musi być zwolnione za pomocą funkcji @ref phfwdDiffDelete.
+ * @param[in] from – wskaźnik na strukturę źródłową;
+ * @param[in] to   – wskaźnik na strukturę docelową.
+ * @return Wskaźnik na porównanie lub NULL, gdy któryś z argumentów ma wartość
+ *         NULL lub nie udało się alokować pamięci.
+ */
+PhoneForwardDiff * phfwdDiffNew(PhoneForward const *from, PhoneForward const *to);
+
+/** @brief Wydaje kolejną operację.
+ * Operacje trzeba stosować w kolejności wydawania. Napisy są ważne do
+ * następnego wywołania funkcji na tym porównaniu. Po wyniku @p false funkcja
+ * @ref phfwdDiffFailed odróżnia koniec operacji od braku pamięci; po błędzie
+ * wydane dotąd operacje nie zamieniają @p from w @p to.
+ * @param[in,out] diff – wskaźnik na porównanie;
+ * @param[out] add     – wskaźnik, pod którym zostanie zapisana wartość
+ *                       @p true dla @ref phfwdAdd i @p false dla
+ *                       @ref phfwdRemove;
+ * @param[out] num1    – wskaźnik, pod którym zostanie zapisany pierwszy
+ *                       argument operacji;
+ * @param[out] num2    – wskaźnik, pod którym zostanie zapisany drugi argument
+ *                       @ref phfwdAdd lub NULL.
+ * @return Wartość @p true, jeśli wydano operację. Wartość @p false, jeśli
+ *         operacje się skończyły, @p diff ma wartość NULL lub nie udało się
+ *         alokować pamięci.
+ */
+bool phfwdDiffNext(PhoneForwardDiff *diff, bool *add, char const **num1,
+                   char const **num2);
+
+/** @brief Sprawdza, czy w porównaniu wystąpił błąd.
+ * @param[in] diff – wskaźnik na porównanie.
+ * @return Wartość @p true, jeśli porównanie przestało wydawać operacje, bo nie
+ *         udało się alokować pamięci. Wartość @p false w przeciwnym przypadku
+ *         lub gdy @p diff ma wartość NULL.
+ */
+bool phfwdDiffFailed(PhoneForwardDiff const *diff);
+
+/** @brief Usuwa porównanie.
+ * Nic nie robi, jeśli wskaźnik @p diff ma wartość NULL.
+ * @param[in] diff – wskaźnik na usuwane porównanie.
+ */
+void phfwdDiffDelete(PhoneForwardDiff *diff);
+
 #endif /* __PHONE_FORWARD_H__ */
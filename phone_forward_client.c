@@ -0,0 +1,345 @@
+/** @file
+ * Generator obciążenia dla serwera przekierowań
+ *
+ * Otwiera zadaną liczbę połączeń, każde w osobnym wątku, i w każdym trzyma
+ * w locie do @p depth żądań. Po zakończeniu wypisuje przepustowość oraz
+ * percentyle opóźnień mierzonych od wysłania żądania do odebrania odpowiedzi.
+ *
+ * Użycie: phone_forward_client ŚCIEŻKA_GNIAZDA [-c POŁĄCZENIA] [-n ŻĄDANIA]
+ *         [-d GŁĘBOKOŚĆ] [-w PROCENT_ZMIAN] [-r PROCENT_ODWRÓCEŃ]
+ *         [-p WSTĘPNE_PRZEKIEROWANIA]
+ *
+ * @author Tsimafei Lukashevich
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "phone_forward_protocol.h"
+
+/** Największa długość generowanego numeru */
+#define MAX_NUMBER 16
+
+/** Największa długość ramki żądania: pole długości, identyfikator, operacja
+ * i dwa numery, każdy ze swoją długością */
+#define MAX_REQUEST (PHFWD_LENGTH_SIZE + 4 + 1 + 2 * (4 + MAX_NUMBER))
+
+/** Początkowy rozmiar bufora odbiorczego */
+#define RECV_SIZE 65536
+
+/** @struct options
+    @var path - ścieżka gniazda serwera;
+    @var connections - liczba połączeń;
+    @var requests - liczba żądań na wszystkich połączeniach;
+    @var depth - liczba żądań w locie na połączenie;
+    @var write_percent - procent żądań Add;
+    @var reverse_percent - procent żądań Reverse;
+    @var prefill - liczba przekierowań dodawanych przed pomiarem
+ */
+struct options{
+    char const *path;
+    size_t connections;
+    size_t requests;
+    size_t depth;
+    unsigned write_percent;
+    unsigned reverse_percent;
+    size_t prefill;
+};
+typedef struct options options;
+
+/** @struct client
+    @var opts - ustawienia pomiaru;
+    @var requests - liczba żądań tego połączenia;
+    @var latencies - zmierzone opóźnienia w nanosekundach;
+    @var errors - liczba odpowiedzi z błędnym statusem lub identyfikatorem;
+    @var seed - ziarno generatora liczb losowych;
+    @var ok - czy połączenie działało do końca
+ */
+struct client{
+    options const *opts;
+    size_t requests;
+    uint64_t *latencies;
+    size_t errors;
+    unsigned seed;
+    bool ok;
+};
+typedef struct client client;
+
+/** @brief Zwraca bieżący czas
+ *
+ * @return czas w nanosekundach
+ */
+uint64_t now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000u + (uint64_t) time.tv_nsec;
+}
+
+/** @brief Łączy się z serwerem
+ *
+ * @param[in] path - ścieżka gniazda
+ * @return deskryptor gniazda lub -1
+ */
+int connectTo(char const *path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) return -1;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/** @brief Losuje numer
+ *
+ * @param[out] num - bufor na numer o rozmiarze co najmniej MAX_NUMBER + 1
+ * @param[in] length - długość numeru
+ * @param[in,out] seed - ziarno generatora
+ */
+void randomNumber(char *num, size_t length, unsigned *seed) {
+    for (size_t i = 0; i < length; i++)
+        num[i] = (char) ('0' + rand_r(seed) % 10);
+    num[length] = '\0';
+}
+
+/** @brief Dopisuje ramkę żądania
+ *
+ * @param[out] out - bufor wielkości co najmniej MAX_REQUEST bajtów
+ * @param[in] id - identyfikator żądania
+ * @param[in] op - operacja
+ * @param[in] num1 - pierwszy numer
+ * @param[in] num2 - drugi numer lub NULL
+ * @return liczba zapisanych bajtów
+ */
+size_t putRequest(unsigned char *out, uint32_t id, unsigned char op, char const *num1, char const *num2) {
+    size_t length = 4 + 1 + 4 + strlen(num1) + (num2 ? 4 + strlen(num2) : 0);
+    size_t offset = 0;
+    phfwdPutU32(out + offset, (uint32_t) length); offset += 4;
+    phfwdPutU32(out + offset, id); offset += 4;
+    out[offset++] = op;
+    phfwdPutU32(out + offset, (uint32_t) strlen(num1)); offset += 4;
+    memcpy(out + offset, num1, strlen(num1)); offset += strlen(num1);
+    if (num2) {
+        phfwdPutU32(out + offset, (uint32_t) strlen(num2)); offset += 4;
+        memcpy(out + offset, num2, strlen(num2)); offset += strlen(num2);
+    }
+    return offset;
+}
+
+/** @brief Tworzy losowe żądanie
+ *
+ * @param[out] out - bufor na ramkę
+ * @param[in] id - identyfikator żądania
+ * @param[in] opts - ustawienia pomiaru
+ * @param[in] write - czy żądanie ma być zmianą
+ * @param[in,out] seed - ziarno generatora
+ * @return liczba zapisanych bajtów
+ */
+size_t randomRequest(unsigned char *out, uint32_t id, options const *opts, bool write, unsigned *seed) {
+    char num1[MAX_NUMBER + 1], num2[MAX_NUMBER + 1];
+    if (write) {
+        randomNumber(num1, 3 + (size_t) rand_r(seed) % 4, seed);
+        randomNumber(num2, 3 + (size_t) rand_r(seed) % 4, seed);
+        return putRequest(out, id, PHFWD_OP_ADD, num1, num2);
+    }
+    unsigned roll = (unsigned) rand_r(seed) % 100;
+    if (roll < opts->write_percent)
+        return randomRequest(out, id, opts, true, seed);
+    randomNumber(num1, 9, seed);
+    if (roll < opts->write_percent + opts->reverse_percent)
+        return putRequest(out, id, PHFWD_OP_REVERSE, num1, NULL);
+    return putRequest(out, id, PHFWD_OP_GET, num1, NULL);
+}
+
+/** @brief Wykonuje pomiar na jednym połączeniu
+ * Na początku wysyła @p depth żądań, a potem po każdej porcji odpowiedzi
+ * dosyła jedną porcją tyle żądań, ile odpowiedzi przyszło.
+ * @param[in,out] arg - wskaźnik na stan klienta
+ * @return NULL
+ */
+void *runClient(void *arg) {
+    client *cl = arg;
+    options const *opts = cl->opts;
+    size_t depth = opts->depth;
+    int fd = connectTo(opts->path);
+    uint64_t *sent_at = malloc(sizeof(uint64_t) * depth);
+    unsigned char *out = malloc(depth * MAX_REQUEST);
+    size_t in_capacity = RECV_SIZE;
+    unsigned char *in = malloc(in_capacity);
+    size_t in_length = 0;
+    if (fd < 0 || sent_at == NULL || out == NULL || in == NULL) goto finish;
+
+    size_t sent = 0, received = 0;
+    while (received < cl->requests) {
+        size_t out_length = 0;
+        while (sent < cl->requests && sent - received < depth) {
+            bool write = opts->prefill > 0 && sent < opts->prefill && cl->latencies == NULL;
+            out_length += randomRequest(out + out_length, (uint32_t) sent, opts, write, &cl->seed);
+            sent_at[sent % depth] = now();
+            sent++;
+        }
+        for (size_t done = 0; done < out_length; ) {
+            ssize_t written = send(fd, out + done, out_length - done, MSG_NOSIGNAL);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) goto finish;
+            done += (size_t) written;
+        }
+
+        if (in_length == in_capacity) {
+            unsigned char *bigger = realloc(in, in_capacity * 2);
+            if (bigger == NULL) goto finish;
+            in = bigger;
+            in_capacity *= 2;
+        }
+        ssize_t got = recv(fd, in + in_length, in_capacity - in_length, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) goto finish;
+        in_length += (size_t) got;
+
+        size_t offset = 0;
+        while (in_length - offset >= PHFWD_LENGTH_SIZE) {
+            uint32_t length = phfwdGetU32(in + offset);
+            if (length < 9) goto finish;
+            if (in_length - offset - PHFWD_LENGTH_SIZE < length) break;
+
+            unsigned char const *frame = in + offset + PHFWD_LENGTH_SIZE;
+            if (phfwdGetU32(frame) != (uint32_t) received || frame[4] == PHFWD_STATUS_BAD_REQUEST
+                || frame[4] == PHFWD_STATUS_NO_MEMORY)
+                cl->errors++;
+            if (cl->latencies) cl->latencies[received] = now() - sent_at[received % depth];
+            received++;
+            offset += PHFWD_LENGTH_SIZE + length;
+        }
+        memmove(in, in + offset, in_length - offset);
+        in_length -= offset;
+    }
+    cl->ok = true;
+
+finish:
+    if (fd >= 0) close(fd);
+    free(sent_at);
+    free(out);
+    free(in);
+    return NULL;
+}
+
+/** @brief Porównuje opóźnienia
+ *
+ * @param[in] a - wskaźnik na pierwsze opóźnienie
+ * @param[in] b - wskaźnik na drugie opóźnienie
+ * @return wynik porównania dla qsort
+ */
+int latencyCmp(void const *a, void const *b) {
+    uint64_t x = *(uint64_t const *) a, y = *(uint64_t const *) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/** @brief Wypisuje percentyl opóźnień
+ *
+ * @param[in] name - nazwa percentyla
+ * @param[in] sorted - posortowane opóźnienia
+ * @param[in] count - liczba opóźnień
+ * @param[in] fraction - percentyl jako ułamek
+ */
+void printPercentile(char const *name, uint64_t const *sorted, size_t count, double fraction) {
+    size_t index = (size_t) (fraction * (double) (count - 1));
+    printf("  %-6s %10.1f us\n", name, (double) sorted[index] / 1000.0);
+}
+
+int main(int argc, char *argv[]) {
+    options opts = { NULL, 1, 100000, 32, 0, 0, 0 };
+    int option;
+    while ((option = getopt(argc, argv, "c:n:d:w:r:p:")) != -1) {
+        switch (option) {
+            case 'c': opts.connections = strtoul(optarg, NULL, 10); break;
+            case 'n': opts.requests = strtoul(optarg, NULL, 10); break;
+            case 'd': opts.depth = strtoul(optarg, NULL, 10); break;
+            case 'w': opts.write_percent = (unsigned) strtoul(optarg, NULL, 10); break;
+            case 'r': opts.reverse_percent = (unsigned) strtoul(optarg, NULL, 10); break;
+            case 'p': opts.prefill = strtoul(optarg, NULL, 10); break;
+            default: goto usage;
+        }
+    }
+    if (optind != argc - 1 || opts.connections == 0 || opts.depth == 0 || opts.requests == 0
+        || opts.write_percent + opts.reverse_percent > 100)
+        goto usage;
+    opts.path = argv[optind];
+
+    if (opts.prefill > 0) {
+        client filler = { &opts, opts.prefill, NULL, 0, 1, false };
+        runClient(&filler);
+        if (!filler.ok) { fprintf(stderr, "Cannot prefill server\n"); return 1; }
+    }
+
+    client *clients = calloc(opts.connections, sizeof(client));
+    pthread_t *threads = calloc(opts.connections, sizeof(pthread_t));
+    uint64_t *latencies = malloc(sizeof(uint64_t) * opts.requests);
+    if (clients == NULL || threads == NULL || latencies == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    size_t assigned = 0;
+    for (size_t i = 0; i < opts.connections; i++) {
+        clients[i].opts = &opts;
+        clients[i].requests = opts.requests / opts.connections + (i < opts.requests % opts.connections);
+        clients[i].latencies = latencies + assigned;
+        clients[i].seed = (unsigned) (i + 2);
+        assigned += clients[i].requests;
+    }
+
+    uint64_t start = now();
+    size_t started = 0;
+    for (; started < opts.connections; started++)
+        if (pthread_create(&threads[started], NULL, runClient, &clients[started]) != 0) break;
+    for (size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    double seconds = (double) (now() - start) / 1e9;
+
+    size_t errors = 0;
+    bool ok = started == opts.connections;
+    for (size_t i = 0; i < opts.connections; i++) {
+        errors += clients[i].errors;
+        ok = ok && clients[i].ok;
+    }
+    if (!ok) {
+        fprintf(stderr, "Connection to %s failed\n", opts.path);
+        return 1;
+    }
+
+    qsort(latencies, opts.requests, sizeof(uint64_t), latencyCmp);
+    printf("requests: %zu, connections: %zu, depth: %zu, errors: %zu\n",
+           opts.requests, opts.connections, opts.depth, errors);
+    printf("time: %.3f s, throughput: %.0f req/s\n", seconds, (double) opts.requests / seconds);
+    printf("latency:\n");
+    printPercentile("p50", latencies, opts.requests, 0.50);
+    printPercentile("p90", latencies, opts.requests, 0.90);
+    printPercentile("p99", latencies, opts.requests, 0.99);
+    printPercentile("p99.9", latencies, opts.requests, 0.999);
+    printPercentile("max", latencies, opts.requests, 1.0);
+
+    free(clients);
+    free(threads);
+    free(latencies);
+    return 0;
+
+usage:
+    fprintf(stderr, "Usage: %s SOCKET_PATH [-c CONNECTIONS] [-n REQUESTS] [-d DEPTH]"
+                    " [-w WRITE_PERCENT] [-r REVERSE_PERCENT] [-p PREFILL]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,72 @@
+/** @file
+ * Binarny protokół serwera przekierowań numerów telefonicznych
+ *
+ * Każda ramka zaczyna się od 32-bitowej długości reszty ramki. Żądanie ma
+ * postać: identyfikator (32 bity), operacja (8 bitów) i jeden lub dwa napisy,
+ * każdy poprzedzony swoją 32-bitową długością. Odpowiedź ma postać:
+ * identyfikator żądania (32 bity), status (8 bitów), liczba numerów (32 bity)
+ * i numery, każdy poprzedzony swoją 32-bitową długością. Liczby są zapisane
+ * w sieciowej kolejności bajtów. Klient może wysłać wiele żądań bez czekania
+ * na odpowiedzi; odpowiedzi na żądania z jednego połączenia przychodzą w
+ * kolejności żądań.
+ *
+ * Limit PHFWD_MAX_FRAME dotyczy ramek w obu kierunkach. Wynik, który by go
+ * przekroczył, serwer zastępuje pustą odpowiedzią ze statusem
+ * PHFWD_STATUS_TOO_LARGE.
+ *
+ * @author Tsimafei Lukashevich
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+
+#ifndef __PHONE_FORWARD_PROTOCOL_H__
+#define __PHONE_FORWARD_PROTOCOL_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+/** Największa dopuszczalna długość ramki bez pola długości */
+#define PHFWD_MAX_FRAME (1u << 20)
+
+/** Rozmiar pola długości ramki */
+#define PHFWD_LENGTH_SIZE 4
+
+/** Operacje, o które może prosić klient */
+enum PhoneForwardOp {
+    PHFWD_OP_GET = 1,         /**< @ref phfwdGet, jeden numer */
+    PHFWD_OP_REVERSE = 2,     /**< @ref phfwdReverse, jeden numer */
+    PHFWD_OP_GET_REVERSE = 3, /**< @ref phfwdGetReverse, jeden numer */
+    PHFWD_OP_ADD = 4,         /**< @ref phfwdAdd, dwa numery */
+    PHFWD_OP_REMOVE = 5       /**< @ref phfwdRemove, jeden numer */
+};
+
+/** Statusy odpowiedzi */
+enum PhoneForwardStatus {
+    PHFWD_STATUS_OK = 0,          /**< operacja się udała */
+    PHFWD_STATUS_FAILED = 1,      /**< @ref phfwdAdd zwróciło @p false */
+    PHFWD_STATUS_BAD_REQUEST = 2, /**< nieznana operacja lub zła ramka */
+    PHFWD_STATUS_NO_MEMORY = 3,   /**< nie udało się alokować pamięci */
+    PHFWD_STATUS_TOO_LARGE = 4    /**< wynik nie mieści się w jednej ramce */
+};
+
+/** @brief Zapisuje liczbę w sieciowej kolejności bajtów.
+ * @param[out] data – miejsce na 4 bajty;
+ * @param[in] value – zapisywana liczba.
+ */
+static inline void phfwdPutU32(unsigned char *data, uint32_t value) {
+    value = htonl(value);
+    memcpy(data, &value, sizeof(value));
+}
+
+/** @brief Odczytuje liczbę zapisaną w sieciowej kolejności bajtów.
+ * @param[in] data – wskaźnik na 4 bajty.
+ * @return Odczytana liczba.
+ */
+static inline uint32_t phfwdGetU32(unsigned char const *data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return ntohl(value);
+}
+
+#endif /* __PHONE_FORWARD_PROTOCOL_H__ */
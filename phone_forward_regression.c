@@ -0,0 +1,740 @@
+/** @file
+ * Testy regresyjne modułu przekierowań numerów telefonicznych
+ *
+ * Każdy test porównuje wyniki modułu z prostym modelem, który trzyma
+ * przekierowania w tablicy i wyznacza wyniki wprost z definicji. Numery są
+ * losowane z małego alfabetu, żeby często były swoimi prefiksami.
+ *
+ * @author Tsimafei Lukashevich
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "phone_forward.h"
+
+/** Największa liczba przekierowań w modelu */
+#define MAX_RULES 256
+
+/** Największa długość numeru w testach */
+#define MAX_LENGTH 64
+
+/** Największa liczba numerów w wyniku odwrócenia */
+#define MAX_RESULTS (MAX_RULES + 1)
+
+/** Sprawdza warunek i zlicza niespełnione */
+#define CHECK(condition)                                                    \
+    do {                                                                    \
+        if (!(condition)) {                                                 \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+/** @struct model
+    @var num1 - prefiksy przekierowywane;
+    @var num2 - prefiksy, na które są przekierowania;
+    @var count - liczba przekierowań
+ */
+struct model{
+    char num1[MAX_RULES][MAX_LENGTH];
+    char num2[MAX_RULES][MAX_LENGTH];
+    size_t count;
+};
+typedef struct model model;
+
+/** Liczba niespełnionych warunków */
+static int failures = 0;
+
+/** @brief Losuje numer
+ *
+ * @param[out] num - bufor na numer
+ * @param[in] max_length - największa długość numeru
+ * @param[in] digits - liczba cyfr, z których losujemy
+ */
+void randomNumber(char *num, int max_length, int digits) {
+    static char const alphabet[] = "0123456789*#";
+    int length = 1 + rand() % max_length;
+    for (int i = 0; i < length; i++)
+        num[i] = alphabet[rand() % digits];
+    num[length] = '\0';
+}
+
+/** @brief Dodaje przekierowanie do modelu
+ *
+ * @param[in,out] m - model
+ * @param[in] num1 - prefiks przekierowywany
+ * @param[in] num2 - prefiks docelowy
+ */
+void modelAdd(model *m, char const *num1, char const *num2) {
+    for (size_t i = 0; i < m->count; i++)
+        if (strcmp(m->num1[i], num1) == 0) {
+            strcpy(m->num2[i], num2);
+            return;
+        }
+    if (m->count == MAX_RULES) return;
+    strcpy(m->num1[m->count], num1);
+    strcpy(m->num2[m->count], num2);
+    m->count++;
+}
+
+/** @brief Losuje przekierowanie i dodaje je do modelu i struktury
+ *
+ * @param[in,out] m - model
+ * @param[in,out] pf - struktura
+ * @param[in] digits - liczba cyfr, z których losujemy
+ */
+void randomAdd(model *m, PhoneForward *pf, int digits) {
+    char num1[MAX_LENGTH], num2[MAX_LENGTH];
+    randomNumber(num1, 4, digits);
+    randomNumber(num2, 3, digits);
+    if (strcmp(num1, num2) == 0) return;
+    bool known = false;
+    for (size_t i = 0; i < m->count; i++)
+        known = known || strcmp(m->num1[i], num1) == 0;
+    if (!known && m->count == MAX_RULES) return;
+    CHECK(phfwdAdd(pf, num1, num2));
+    modelAdd(m, num1, num2);
+}
+
+/** @brief Usuwa z modelu przekierowania prefiksów zaczynających się od numeru
+ *
+ * @param[in,out] m - model
+ * @param[in] num - numer
+ */
+void modelRemove(model *m, char const *num) {
+    size_t length = strlen(num), kept = 0;
+    for (size_t i = 0; i < m->count; i++) {
+        if (strncmp(m->num1[i], num, length) == 0) continue;
+        if (kept != i) {
+            strcpy(m->num1[kept], m->num1[i]);
+            strcpy(m->num2[kept], m->num2[i]);
+        }
+        kept++;
+    }
+    m->count = kept;
+}
+
+/** @brief Losuje zmianę i wykonuje ją na modelu i strukturze
+ * Co czwarta zmiana usuwa przekierowania, pozostałe dodają przekierowanie.
+ * @param[in,out] m - model
+ * @param[in,out] pf - struktura
+ * @param[in] digits - liczba cyfr, z których losujemy
+ */
+void randomChange(model *m, PhoneForward *pf, int digits) {
+    if (rand() % 4 != 0) {
+        randomAdd(m, pf, digits);
+        return;
+    }
+    char num[MAX_LENGTH];
+    randomNumber(num, 3, digits);
+    phfwdRemove(pf, num);
+    modelRemove(m, num);
+}
+
+/** @brief Wyznacza przekierowanie numeru w modelu
+ *
+ * @param[in] m - model
+ * @param[in] num - numer
+ * @param[out] result - bufor na wynik
+ */
+void modelGet(model const *m, char const *num, char *result) {
+    size_t best = m->count, best_length = 0;
+    for (size_t i = 0; i < m->count; i++) {
+        size_t length = strlen(m->num1[i]);
+        if (strncmp(num, m->num1[i], length) == 0 && length > best_length) {
+            best = i;
+            best_length = length;
+        }
+    }
+    if (best == m->count) {
+        strcpy(result, num);
+        return;
+    }
+    strcpy(result, m->num2[best]);
+    strcat(result, num + best_length);
+}
+
+/** @brief Porównuje napisy dla qsort
+ * @param[in] a - wskaźnik na pierwszy napis
+ * @param[in] b - wskaźnik na drugi napis
+ * @return wynik strcmp
+ */
+int compareStrings(void const *a, void const *b) {
+    return strcmp((char const *) a, (char const *) b);
+}
+
+/** @brief Odwraca przekierowania w modelu
+ *
+ * @param[in] m - model
+ * @param[in] num - numer
+ * @param[in] isGet - czy zostawić tylko numery x, że phfwdGet(x) = num
+ * @param[out] results - posortowane numery bez powtórzeń
+ * @return liczba numerów
+ */
+size_t modelReverse(model const *m, char const *num, bool isGet, char results[][MAX_LENGTH]) {
+    size_t count = 0;
+    strcpy(results[count++], num);
+    for (size_t i = 0; i < m->count; i++) {
+        size_t length = strlen(m->num2[i]);
+        if (strncmp(num, m->num2[i], length) != 0) continue;
+        strcpy(results[count], m->num1[i]);
+        strcat(results[count++], num + length);
+    }
+    qsort(results, count, MAX_LENGTH, compareStrings);
+
+    size_t unique = 0;
+    char forwarded[MAX_LENGTH];
+    for (size_t i = 0; i < count; i++) {
+        if (unique > 0 && strcmp(results[unique - 1], results[i]) == 0) continue;
+        modelGet(m, results[i], forwarded);
+        if (isGet && strcmp(forwarded, num) != 0) continue;
+        if (unique != i) strcpy(results[unique], results[i]);
+        unique++;
+    }
+    return unique;
+}
+
+/** @brief Sprawdza, czy ciąg numerów jest równy oczekiwanemu
+ *
+ * @param[in] pnum - ciąg numerów
+ * @param[in] expected - oczekiwane numery
+ * @param[in] count - liczba oczekiwanych numerów
+ * @return true , jak ciągi są równe
+ */
+bool numbersEqual(PhoneNumbers const *pnum, char const expected[][MAX_LENGTH], size_t count) {
+    if (pnum == NULL) return false;
+    for (size_t i = 0; i < count; i++)
+        if (phnumGet(pnum, i) == NULL || strcmp(phnumGet(pnum, i), expected[i]) != 0)
+            return false;
+    return phnumGet(pnum, count) == NULL;
+}
+
+/** @brief Sprawdza, czy kursor wydaje oczekiwane numery
+ *
+ * @param[in] cur - kursor
+ * @param[in] expected - oczekiwane numery
+ * @param[in] count - liczba oczekiwanych numerów
+ * @return true , jak kursor wydał dokładnie te numery
+ */
+bool cursorEqual(PhoneCursor *cur, char const expected[][MAX_LENGTH], size_t count) {
+    if (cur == NULL) return false;
+    for (size_t i = 0; i < count; i++) {
+        char const *num = phcurNext(cur);
+        if (num == NULL || strcmp(num, expected[i]) != 0) return false;
+    }
+    return phcurNext(cur) == NULL && !phcurFailed(cur);
+}
+
+/** @brief Porównuje kursory, phfwdReverse i phfwdGetReverse z modelem
+ * Sprawdza też strony kursora zaczynające się po każdym numerze wyniku.
+ */
+void testCursors(void) {
+    static char expected[MAX_RESULTS][MAX_LENGTH];
+    for (int round = 0; round < 20; round++) {
+        model m = { .count = 0 };
+        PhoneForward *pf = phfwdNew();
+        CHECK(pf != NULL);
+        for (int i = 0; i < 150; i++)
+            randomAdd(&m, pf, round % 2 ? 3 : 12);
+
+        for (int query = 0; query < 100; query++) {
+            char num[MAX_LENGTH];
+            randomNumber(num, 6, round % 2 ? 3 : 12);
+            for (int isGet = 0; isGet < 2; isGet++) {
+                size_t count = modelReverse(&m, num, isGet, expected);
+                PhoneNumbers *pnum = isGet ? phfwdGetReverse(pf, num) : phfwdReverse(pf, num);
+                CHECK(numbersEqual(pnum, (char const (*)[MAX_LENGTH]) expected, count));
+                phnumDelete(pnum);
+
+                PhoneCursor *cur = isGet ? phfwdGetReverseCursor(pf, num, NULL) : phfwdReverseCursor(pf, num, NULL);
+                CHECK(cursorEqual(cur, (char const (*)[MAX_LENGTH]) expected, count));
+                phcurDelete(cur);
+
+                for (size_t after = 0; after < count; after++) {
+                    cur = isGet ? phfwdGetReverseCursor(pf, num, expected[after])
+                                : phfwdReverseCursor(pf, num, expected[after]);
+                    size_t left = count - after - 1;
+                    pnum = phcurPage(cur, 3);
+                    CHECK(numbersEqual(pnum, (char const (*)[MAX_LENGTH]) expected + after + 1, left < 3 ? left : 3));
+                    phnumDelete(pnum);
+                    phcurDelete(cur);
+                }
+            }
+        }
+        phfwdDelete(pf);
+    }
+}
+
+/** @brief Sprawdza, że kursor nie widzi zmian struktury
+ * Kursory są tworzone przed zmianami, częściowo przeczytane, a potem
+ * dokończone po dodaniach i usunięciach; muszą wydać wynik sprzed zmian.
+ */
+void testCursorIsolation(void) {
+    static char expected[MAX_RESULTS][MAX_LENGTH];
+    for (int round = 0; round < 20; round++) {
+        int digits = round % 2 ? 3 : 12;
+        model m = { .count = 0 };
+        PhoneForward *pf = phfwdNew();
+        CHECK(pf != NULL);
+        for (int step = 0; step < 150; step++)
+            randomChange(&m, pf, digits);
+
+        for (int query = 0; query < 20; query++) {
+            char num[MAX_LENGTH];
+            randomNumber(num, 4, digits);
+            bool isGet = query % 2;
+            size_t count = modelReverse(&m, num, isGet, expected);
+            PhoneCursor *cur = isGet ? phfwdGetReverseCursor(pf, num, NULL) : phfwdReverseCursor(pf, num, NULL);
+            CHECK(cur != NULL);
+            size_t done = 0;
+            while (done < count / 2) {
+                char const *next = phcurNext(cur);
+                CHECK(next != NULL && strcmp(next, expected[done]) == 0);
+                done++;
+            }
+
+            for (int step = 0; step < 10; step++)
+                randomChange(&m, pf, digits);
+            phfwdRemove(pf, num[0] == '1' ? "2" : "1");
+            modelRemove(&m, num[0] == '1' ? "2" : "1");
+            CHECK(cursorEqual(cur, (char const (*)[MAX_LENGTH]) expected + done, count - done));
+            phcurDelete(cur);
+        }
+        phfwdDelete(pf);
+    }
+}
+
+/** @brief Wyznacza koniec łańcucha przekierowań w modelu
+ *
+ * @param[in] m - model
+ * @param[in] num - numer
+ * @param[in] max_hops - największa liczba kroków
+ * @param[out] result - bufor na ostatni numer łańcucha
+ * @return sposób zakończenia łańcucha
+ */
+PhoneChainStatus modelResolve(model const *m, char const *num, size_t max_hops, char *result) {
+    static char chain[MAX_RULES + 2][MAX_LENGTH * 4];
+    size_t length = 0;
+    strcpy(chain[length++], num);
+    PhoneChainStatus status = PHFWD_CHAIN_END;
+    while (true) {
+        char next[MAX_LENGTH * 4];
+        modelGet(m, chain[length - 1], next);
+        if (strcmp(next, chain[length - 1]) == 0) break;
+        if (length - 1 == max_hops) { status = PHFWD_CHAIN_LIMIT; break; }
+        bool seen = false;
+        for (size_t i = 0; i < length; i++)
+            seen = seen || strcmp(chain[i], next) == 0;
+        if (seen) { status = PHFWD_CHAIN_CYCLE; break; }
+        strcpy(chain[length++], next);
+    }
+    strcpy(result, chain[length - 1]);
+    return status;
+}
+
+/** @brief Sprawdza wynik phfwdResolve
+ *
+ * @param[in,out] pf - struktura
+ * @param[in] num - numer
+ * @param[in] max_hops - największa liczba kroków
+ * @param[in] expected - oczekiwany ostatni numer łańcucha
+ * @param[in] expected_status - oczekiwany sposób zakończenia łańcucha
+ * @return true , jak wynik jest zgodny z oczekiwanym
+ */
+bool resolveEqual(PhoneForward *pf, char const *num, size_t max_hops,
+                  char const *expected, PhoneChainStatus expected_status) {
+    PhoneChainStatus status;
+    PhoneNumbers *pnum = phfwdResolve(pf, num, max_hops, &status);
+    bool ok = pnum != NULL && phnumGet(pnum, 0) != NULL && strcmp(phnumGet(pnum, 0), expected) == 0
+              && phnumGet(pnum, 1) == NULL && status == expected_status;
+    phnumDelete(pnum);
+    return ok;
+}
+
+/** @brief Sprawdza phfwdResolve
+ * Sprawdza cykl, limit kroków, unieważnianie zapamiętanych wyników po
+ * zmianach struktury i niezależność migawek, a potem porównuje wyniki z
+ * modelem dla losowych zmian.
+ */
+void testResolve(void) {
+    PhoneForward *pf = phfwdNew();
+    CHECK(pf != NULL);
+    CHECK(phfwdAdd(pf, "1", "2"));
+    CHECK(phfwdAdd(pf, "2", "3"));
+    CHECK(resolveEqual(pf, "15", 10, "35", PHFWD_CHAIN_END));
+    CHECK(resolveEqual(pf, "15", 10, "35", PHFWD_CHAIN_END));
+    CHECK(resolveEqual(pf, "15", 1, "25", PHFWD_CHAIN_LIMIT));
+    CHECK(resolveEqual(pf, "15", 0, "15", PHFWD_CHAIN_LIMIT));
+    CHECK(resolveEqual(pf, "4", 10, "4", PHFWD_CHAIN_END));
+
+    CHECK(phfwdAdd(pf, "3", "1"));
+    CHECK(resolveEqual(pf, "15", 10, "35", PHFWD_CHAIN_CYCLE));
+    CHECK(resolveEqual(pf, "25", 10, "15", PHFWD_CHAIN_CYCLE));
+
+    PhoneForward *snapshot = phfwdSnapshot(pf);
+    CHECK(snapshot != NULL);
+    phfwdRemove(pf, "3");
+    CHECK(resolveEqual(pf, "15", 10, "35", PHFWD_CHAIN_END));
+    CHECK(resolveEqual(snapshot, "15", 10, "35", PHFWD_CHAIN_CYCLE));
+    CHECK(phfwdAdd(pf, "35", "4"));
+    CHECK(resolveEqual(pf, "15", 10, "4", PHFWD_CHAIN_END));
+    CHECK(resolveEqual(snapshot, "15", 10, "35", PHFWD_CHAIN_CYCLE));
+    phfwdDelete(snapshot);
+    phfwdDelete(pf);
+
+    for (int round = 0; round < 20; round++) {
+        model m = { .count = 0 };
+        pf = phfwdNew();
+        CHECK(pf != NULL);
+        for (int step = 0; step < 200; step++) {
+            randomAdd(&m, pf, 3);
+            for (int query = 0; query < 5; query++) {
+                char num[MAX_LENGTH], expected[MAX_LENGTH * 4];
+                randomNumber(num, 5, 3);
+                size_t max_hops = (size_t) (rand() % 6);
+                PhoneChainStatus status = modelResolve(&m, num, max_hops, expected);
+                CHECK(resolveEqual(pf, num, max_hops, expected, status));
+                CHECK(resolveEqual(pf, num, max_hops, expected, status));
+            }
+        }
+        phfwdDelete(pf);
+    }
+}
+
+/** @brief Sprawdza, czy struktura ma zawartość modelu
+ *
+ * @param[in] pf - struktura
+ * @param[in] m - model
+ * @param[in] digits - liczba cyfr, z których losujemy numery zapytań
+ * @return true , jak wyniki phfwdGet i phfwdReverse są zgodne z modelem
+ */
+bool contentEqual(PhoneForward const *pf, model const *m, int digits) {
+    static char expected[MAX_RESULTS][MAX_LENGTH];
+    bool ok = true;
+    for (int query = 0; query < 20; query++) {
+        char num[MAX_LENGTH], forwarded[MAX_LENGTH * 2];
+        randomNumber(num, 6, digits);
+        modelGet(m, num, forwarded);
+        PhoneNumbers *pnum = phfwdGet(pf, num);
+        ok = ok && pnum != NULL && phnumGet(pnum, 0) != NULL
+             && strcmp(phnumGet(pnum, 0), forwarded) == 0;
+        phnumDelete(pnum);
+
+        size_t count = modelReverse(m, num, false, expected);
+        pnum = phfwdReverse(pf, num);
+        ok = ok && numbersEqual(pnum, (char const (*)[MAX_LENGTH]) expected, count);
+        phnumDelete(pnum);
+    }
+    return ok;
+}
+
+/** @brief Sprawdza niezależność migawek
+ * Tworzy migawki w losowych chwilach i dalej zmienia oryginał, a potem
+ * zmienia migawki. Każda struktura musi mieć zawartość swojego modelu,
+ * także po zwolnieniu pozostałych.
+ */
+void testSnapshots(void) {
+    enum { SNAPSHOTS = 4 };
+    static model models[SNAPSHOTS + 1];
+    for (int round = 0; round < 20; round++) {
+        int digits = round % 2 ? 3 : 12;
+        PhoneForward *pfs[SNAPSHOTS + 1];
+        models[0].count = 0;
+        pfs[0] = phfwdNew();
+        CHECK(pfs[0] != NULL);
+        for (int i = 1; i <= SNAPSHOTS; i++) {
+            for (int step = 0; step < 40; step++)
+                randomChange(&models[0], pfs[0], digits);
+            pfs[i] = phfwdSnapshot(pfs[0]);
+            CHECK(pfs[i] != NULL);
+            models[i] = models[0];
+        }
+        for (int step = 0; step < 40; step++)
+            randomChange(&models[0], pfs[0], digits);
+        for (int i = 0; i <= SNAPSHOTS; i++)
+            CHECK(contentEqual(pfs[i], &models[i], digits));
+
+        for (int i = SNAPSHOTS; i >= 1; i--) {
+            for (int step = 0; step < 20; step++)
+                randomChange(&models[i], pfs[i], digits);
+            for (int j = 0; j <= SNAPSHOTS; j++)
+                CHECK(contentEqual(pfs[j], &models[j], digits));
+        }
+
+        for (int i = 0; i < SNAPSHOTS; i++) {
+            phfwdDelete(pfs[i]);
+            CHECK(contentEqual(pfs[SNAPSHOTS], &models[SNAPSHOTS], digits));
+        }
+        phfwdDelete(pfs[SNAPSHOTS]);
+    }
+}
+
+/** @brief Sprawdza, czy dwie struktury mają te same przekierowania
+ *
+ * @param[in] pf1 - struktura 1
+ * @param[in] pf2 - struktura 2
+ * @return true , jak iteratory obu struktur wydają te same pary
+ */
+bool rulesEqual(PhoneForward const *pf1, PhoneForward const *pf2) {
+    PhoneForwardIter *it1 = phfwdIterNew(pf1), *it2 = phfwdIterNew(pf2);
+    bool ok = it1 != NULL && it2 != NULL;
+    while (ok) {
+        char const *a1, *a2, *b1, *b2;
+        bool more1 = phfwdIterNext(it1, &a1, &a2);
+        bool more2 = phfwdIterNext(it2, &b1, &b2);
+        ok = more1 == more2;
+        if (!ok || !more1) break;
+        ok = strcmp(a1, b1) == 0 && strcmp(a2, b2) == 0;
+    }
+    ok = ok && !phfwdIterFailed(it1) && !phfwdIterFailed(it2);
+    phfwdIterDelete(it1);
+    phfwdIterDelete(it2);
+    return ok;
+}
+
+/** @brief Stosuje operacje porównania do migawki źródła
+ *
+ * @param[in] from - struktura źródłowa
+ * @param[in] to - struktura docelowa
+ * @param[out] operations - liczba wydanych operacji
+ * @return true , jak po operacjach migawka źródła ma przekierowania celu
+ */
+bool diffApplies(PhoneForward const *from, PhoneForward const *to, size_t *operations) {
+    PhoneForward *work = phfwdSnapshot(from);
+    PhoneForwardDiff *diff = phfwdDiffNew(from, to);
+    bool ok = work != NULL && diff != NULL;
+    bool add;
+    char const *num1, *num2;
+    *operations = 0;
+    while (ok && phfwdDiffNext(diff, &add, &num1, &num2)) {
+        if (add) ok = phfwdAdd(work, num1, num2);
+        else phfwdRemove(work, num1);
+        (*operations)++;
+    }
+    ok = ok && !phfwdDiffFailed(diff) && rulesEqual(work, to);
+    phfwdDiffDelete(diff);
+    phfwdDelete(work);
+    return ok;
+}
+
+/** @brief Sprawdza porównania struktur
+ * Porównuje migawki zmieniane niezależnie i niezależne struktury. Dla
+ * migawki zmienionej jednym dodaniem porównanie musi wydać jedną operację.
+ */
+void testDiff(void) {
+    size_t operations;
+    for (int round = 0; round < 40; round++) {
+        int digits = round % 2 ? 3 : 12;
+        model m = { .count = 0 };
+        PhoneForward *from = phfwdNew();
+        CHECK(from != NULL);
+        for (int step = 0; step < 100; step++)
+            randomChange(&m, from, digits);
+
+        PhoneForward *to = phfwdSnapshot(from);
+        CHECK(to != NULL);
+        CHECK(diffApplies(from, to, &operations) && operations == 0);
+        CHECK(phfwdAdd(to, "123456", "7"));
+        CHECK(diffApplies(from, to, &operations) && operations == 1);
+        CHECK(diffApplies(to, from, &operations) && operations == 1);
+
+        for (int step = 0; step < 30; step++) {
+            randomChange(&m, to, digits);
+            if (step % 3 == 0) randomChange(&m, from, digits);
+            CHECK(diffApplies(from, to, &operations));
+            CHECK(diffApplies(to, from, &operations));
+        }
+        phfwdDelete(to);
+
+        model other = { .count = 0 };
+        to = phfwdNew();
+        CHECK(to != NULL);
+        for (int step = 0; step < 100; step++)
+            randomChange(&other, to, digits);
+        CHECK(diffApplies(from, to, &operations));
+        CHECK(diffApplies(to, from, &operations));
+        phfwdDelete(to);
+        phfwdDelete(from);
+    }
+}
+
+/** @brief Porównuje phfwdIsForwarded i phfwdGetInto z phfwdGet
+ * Sprawdza też obcinanie wyniku do małych buforów i napisy, które nie są
+ * numerami.
+ */
+void testGetInto(void) {
+    char buffer[MAX_LENGTH * 2];
+    for (int round = 0; round < 20; round++) {
+        model m = { .count = 0 };
+        PhoneForward *pf = phfwdNew();
+        CHECK(pf != NULL);
+        for (int step = 0; step < 150; step++)
+            randomChange(&m, pf, round % 2 ? 3 : 12);
+
+        for (int query = 0; query < 200; query++) {
+            char num[MAX_LENGTH];
+            randomNumber(num, 6, round % 2 ? 3 : 12);
+            PhoneNumbers *pnum = phfwdGet(pf, num);
+            char const *expected = phnumGet(pnum, 0);
+            CHECK(expected != NULL);
+            if (expected == NULL) { phnumDelete(pnum); continue; }
+
+            size_t length = strlen(expected);
+            CHECK(phfwdIsForwarded(pf, num) == (strcmp(expected, num) != 0));
+            CHECK(phfwdGetInto(pf, num, buffer, sizeof(buffer)) == length);
+            CHECK(strcmp(buffer, expected) == 0);
+            CHECK(phfwdGetInto(pf, num, NULL, 0) == length);
+            for (size_t size = 1; size <= length; size++) {
+                CHECK(phfwdGetInto(pf, num, buffer, size) == length);
+                CHECK(strlen(buffer) == size - 1 && strncmp(buffer, expected, size - 1) == 0);
+            }
+            phnumDelete(pnum);
+        }
+
+        CHECK(!phfwdIsForwarded(pf, "12a"));
+        CHECK(!phfwdIsForwarded(pf, ""));
+        CHECK(!phfwdIsForwarded(pf, NULL));
+        CHECK(phfwdGetInto(pf, "12a", buffer, sizeof(buffer)) == 0 && buffer[0] == '\0');
+        CHECK(phfwdGetInto(pf, NULL, buffer, sizeof(buffer)) == 0 && buffer[0] == '\0');
+        phfwdDelete(pf);
+    }
+}
+
+/** @brief Liczy numery wydawane przez kursor
+ *
+ * @param[in] cur - kursor
+ * @param[in] first - oczekiwany pierwszy numer
+ * @return liczba numerów lub 0, gdy pierwszy numer jest inny
+ */
+size_t cursorCount(PhoneCursor *cur, char const *first) {
+    char const *num = phcurNext(cur);
+    if (num == NULL || strcmp(num, first) != 0) return 0;
+    size_t count = 1;
+    while (phcurNext(cur) != NULL) count++;
+    return phcurFailed(cur) ? 0 : count;
+}
+
+/** @brief Sprawdza usuwanie wielu przekierowań na ten sam numer
+ * Usunięcie połowy z 20000 przekierowań na jeden numer musi zostawić
+ * drugą połowę, nie zmienić migawki i zająć mniej niż sekundę; usuwanie po
+ * jednym przekierowaniu z przejściem listy od początku trwa tu kilkanaście
+ * sekund. Przekierowania są dodawane malejąco, bo wtedy każde trafia na
+ * początek listy.
+ */
+void testRemoveShared(void) {
+    enum { RULES = 10000 };
+    char num[MAX_LENGTH];
+    PhoneForward *pf = phfwdNew();
+    CHECK(pf != NULL);
+    for (int first = 2; first >= 1; first--)
+        for (int i = RULES - 1; i >= 0; i--) {
+            sprintf(num, "%d%07d", first, i);
+            CHECK(phfwdAdd(pf, num, "9"));
+        }
+    PhoneForward *snapshot = phfwdSnapshot(pf);
+    CHECK(snapshot != NULL);
+
+    clock_t start = clock();
+    phfwdRemove(pf, "2");
+    CHECK(clock() - start < CLOCKS_PER_SEC);
+
+    PhoneCursor *cur = phfwdReverseCursor(pf, "95", NULL);
+    CHECK(cursorCount(cur, "100000005") == RULES + 1);
+    phcurDelete(cur);
+    cur = phfwdReverseCursor(pf, "95", "100099995");
+    CHECK(cursorCount(cur, "95") == 1);
+    phcurDelete(cur);
+    cur = phfwdReverseCursor(snapshot, "95", "100099995");
+    CHECK(cursorCount(cur, "200000005") == RULES + 1);
+    phcurDelete(cur);
+
+    phfwdRemove(pf, "1");
+    cur = phfwdReverseCursor(pf, "95", NULL);
+    CHECK(cursorCount(cur, "95") == 1);
+    phcurDelete(cur);
+    phfwdDelete(snapshot);
+    phfwdDelete(pf);
+}
+
+/** @brief Sprawdza, czy dwa ciągi numerów są równe
+ *
+ * @param[in] pnum1 - ciąg 1
+ * @param[in] pnum2 - ciąg 2
+ * @return true , jak oba ciągi istnieją i mają te same numery
+ */
+bool sameNumbers(PhoneNumbers const *pnum1, PhoneNumbers const *pnum2) {
+    if (pnum1 == NULL || pnum2 == NULL) return false;
+    for (size_t i = 0; ; i++) {
+        char const *num1 = phnumGet(pnum1, i), *num2 = phnumGet(pnum2, i);
+        if (num1 == NULL || num2 == NULL) return num1 == num2;
+        if (strcmp(num1, num2) != 0) return false;
+    }
+}
+
+/** @brief Porównuje phfwdGetBatch i phfwdReverseBatch z pojedynczymi zapytaniami
+ * Grupy mają rozmiary, które nie są wielokrotnością rozmiaru porcji, i
+ * zawierają napisy niebędące numerami oraz NULL, a struktura przechodzi też
+ * przez usunięcia.
+ */
+void testBatches(void) {
+    enum { MAX_BATCH = 70 };
+    static char storage[MAX_BATCH][MAX_LENGTH];
+    char const *nums[MAX_BATCH];
+    PhoneNumbers *results[MAX_BATCH];
+    for (int round = 0; round < 20; round++) {
+        int digits = round % 2 ? 3 : 12;
+        model m = { .count = 0 };
+        PhoneForward *pf = phfwdNew();
+        CHECK(pf != NULL);
+        for (int step = 0; step < 150; step++)
+            randomChange(&m, pf, digits);
+
+        for (int query = 0; query < 20; query++) {
+            size_t count = (size_t) (rand() % MAX_BATCH);
+            for (size_t i = 0; i < count; i++) {
+                int kind = rand() % 10;
+                randomNumber(storage[i], 6, digits);
+                if (kind == 0) strcat(storage[i], "a");
+                if (kind == 1) storage[i][0] = '\0';
+                nums[i] = kind == 2 ? NULL : storage[i];
+            }
+
+            for (int reverse = 0; reverse < 2; reverse++) {
+                bool ok = reverse ? phfwdReverseBatch(pf, nums, count, results)
+                                  : phfwdGetBatch(pf, nums, count, results);
+                CHECK(ok);
+                for (size_t i = 0; ok && i < count; i++) {
+                    PhoneNumbers *single = reverse ? phfwdReverse(pf, nums[i]) : phfwdGet(pf, nums[i]);
+                    CHECK(sameNumbers(results[i], single));
+                    phnumDelete(single);
+                    phnumDelete(results[i]);
+                }
+            }
+        }
+        phfwdDelete(pf);
+    }
+    CHECK(phfwdGetBatch(NULL, nums, 0, results) == false);
+    CHECK(phfwdReverseBatch(NULL, nums, 0, results) == false);
+}
+
+int main(void) {
+    srand(2022);
+    testCursors();
+    testCursorIsolation();
+    testResolve();
+    testSnapshots();
+    testDiff();
+    testGetInto();
+    testRemoveShared();
+    testBatches();
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,793 @@
+/** @file
+ * Serwer udostępniający jedną strukturę przekierowań przez gniazdo UNIX
+ *
+ * Wątek główny obsługuje połączenia za pomocą epoll i wycina z nich pełne
+ * ramki żądań. Wszystkie ramki przeczytane z połączenia trafiają jako jedno
+ * zadanie do puli wątków roboczych, a odpowiedzi wracają do wątku głównego,
+ * który je wysyła. Połączenie ma naraz co najwyżej jedno zadanie, więc
+ * odpowiedzi zachowują kolejność żądań. Odczyty wykonują się równolegle pod
+ * blokadą do czytania, a kolejne odczyty tego samego rodzaju idą razem przez
+ * phfwdGetBatch lub phfwdReverseBatch; zmiany wykonują się pod blokadą do
+ * pisania. Póki zadanie połączenia jest w pracy albo jego bufory są pełne,
+ * serwer nie czyta z tego połączenia, więc klient, który nie odbiera
+ * odpowiedzi, nie zajmie dowolnie dużo pamięci.
+ *
+ * Użycie: phone_forward_server ŚCIEŻKA_GNIAZDA [LICZBA_WĄTKÓW]
+ *
+ * @author Tsimafei Lukashevich
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "phone_forward.h"
+#include "phone_forward_protocol.h"
+
+/** Domyślna liczba wątków roboczych */
+#define DEFAULT_THREADS 4
+
+/** Największa liczba zdarzeń odbieranych naraz z epoll */
+#define MAX_EVENTS 64
+
+/** Rozmiar porcji, o którą powiększamy bufor przy czytaniu */
+#define READ_CHUNK 65536
+
+/** Liczba bajtów w buforze połączenia, powyżej której przestajemy czytać */
+#define MAX_BUFFERED (4 * (size_t) PHFWD_MAX_FRAME)
+
+/** Największa liczba żądań wykonywanych przez wątek roboczy naraz */
+#define MAX_REQUESTS 64
+
+/** @struct buffer
+    @var data - bajty bufora;
+    @var length - liczba zajętych bajtów;
+    @var capacity - rozmiar zaalokowanej pamięci
+ */
+struct buffer{
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+};
+typedef struct buffer buffer;
+
+/** @struct connection
+    @var fd - deskryptor gniazda, -1 po zamknięciu;
+    @var in - przeczytane bajty, które nie trafiły jeszcze do zadania;
+    @var out - odpowiedzi czekające na wysłanie;
+    @var sent - liczba wysłanych już bajtów z @p out;
+    @var busy - czy zadanie z tego połączenia jest w pracy;
+    @var events - zdarzenia, na które czekamy w epoll;
+    @var prev - poprzednie połączenie na liście serwera;
+    @var next - następne połączenie na liście serwera
+ */
+struct connection{
+    int fd;
+    buffer in;
+    buffer out;
+    size_t sent;
+    bool busy;
+    uint32_t events;
+    struct connection *prev;
+    struct connection *next;
+};
+typedef struct connection connection;
+
+/** @struct job
+    @var conn - połączenie, z którego pochodzą żądania;
+    @var requests - pełne ramki żądań;
+    @var responses - ramki odpowiedzi;
+    @var failed - czy zabrakło pamięci nawet na odpowiedź o braku pamięci,
+                  wtedy połączenie trzeba zamknąć;
+    @var next - następne zadanie w kolejce
+ */
+struct job{
+    connection *conn;
+    buffer requests;
+    buffer responses;
+    bool failed;
+    struct job *next;
+};
+typedef struct job job;
+
+/** @struct request
+    @var id - identyfikator żądania;
+    @var op - operacja;
+    @var status - status odpowiedzi;
+    @var num1 - pierwszy napis żądania;
+    @var num2 - drugi napis żądania, tylko dla PHFWD_OP_ADD;
+    @var pnum - numery wyniku
+ */
+struct request{
+    uint32_t id;
+    unsigned char op;
+    int status;
+    char *num1;
+    char *num2;
+    PhoneNumbers *pnum;
+};
+typedef struct request request;
+
+/** @struct queue
+    @var lock - blokada kolejki;
+    @var ready - sygnalizuje pojawienie się zadania;
+    @var head - pierwsze zadanie;
+    @var tail - ostatnie zadanie;
+    @var stop - czy wątki robocze mają się zakończyć
+ */
+struct queue{
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    job *head;
+    job *tail;
+    bool stop;
+};
+typedef struct queue queue;
+
+/** @struct server
+    @var pf - udostępniana struktura przekierowań;
+    @var lock - blokada struktury @p pf;
+    @var todo - zadania dla wątków roboczych;
+    @var done - zadania wykonane, czekające na wątek główny;
+    @var epoll_fd - deskryptor epoll;
+    @var listen_fd - gniazdo nasłuchujące;
+    @var event_fd - budzi wątek główny, gdy są wykonane zadania;
+    @var connections - lista otwartych połączeń;
+    @var closed - zamknięte połączenia, zwalniane dopiero po obsłużeniu
+                  wszystkich zdarzeń odebranych razem z epoll, bo dalsze
+                  zdarzenia mogą na nie wskazywać
+ */
+struct server{
+    PhoneForward *pf;
+    pthread_rwlock_t lock;
+    queue todo;
+    queue done;
+    int epoll_fd;
+    int listen_fd;
+    int event_fd;
+    connection *connections;
+    connection *closed;
+};
+typedef struct server server;
+
+/** Czy otrzymaliśmy sygnał zakończenia */
+static volatile sig_atomic_t stopping = 0;
+
+/** Deskryptor budzący wątek główny z procedury obsługi sygnału */
+static int wakeup_fd = -1;
+
+/** @brief Obsługuje sygnał zakończenia
+ *
+ * @param[in] signal - numer sygnału
+ */
+void onSignal(int signal) {
+    (void) signal;
+    stopping = 1;
+    uint64_t one = 1;
+    if (write(wakeup_fd, &one, sizeof(one)) < 0) return;
+}
+
+/** @brief Zapewnia miejsce w buforze
+ *
+ * @param[in,out] buf - bufor
+ * @param[in] extra - liczba bajtów, które chcemy dopisać
+ * @return false , jak nie udało się alokować pamięci
+ */
+bool bufferReserve(buffer *buf, size_t extra) {
+    if (buf->length + extra <= buf->capacity) return true;
+    size_t capacity = buf->capacity ? buf->capacity : 256;
+    while (capacity < buf->length + extra) capacity *= 2;
+    unsigned char *data = realloc(buf->data, capacity);
+    if (data == NULL) return false;
+    buf->data = data;
+    buf->capacity = capacity;
+    return true;
+}
+
+/** @brief Dopisuje bajty do bufora
+ *
+ * @param[in,out] buf - bufor
+ * @param[in] data - dopisywane bajty
+ * @param[in] length - liczba bajtów
+ * @return false , jak nie udało się alokować pamięci
+ */
+bool bufferAppend(buffer *buf, void const *data, size_t length) {
+    if (!bufferReserve(buf, length)) return false;
+    memcpy(buf->data + buf->length, data, length);
+    buf->length += length;
+    return true;
+}
+
+/** @brief Dopisuje liczbę do bufora
+ *
+ * @param[in,out] buf - bufor
+ * @param[in] value - liczba
+ * @return false , jak nie udało się alokować pamięci
+ */
+bool bufferAppendU32(buffer *buf, uint32_t value) {
+    unsigned char data[4];
+    phfwdPutU32(data, value);
+    return bufferAppend(buf, data, sizeof(data));
+}
+
+/** @brief Wstawia zadanie na koniec kolejki
+ *
+ * @param[in,out] q - kolejka
+ * @param[in] task - zadanie
+ */
+void queuePush(queue *q, job *task) {
+    pthread_mutex_lock(&q->lock);
+    task->next = NULL;
+    if (q->tail) q->tail->next = task;
+    else q->head = task;
+    q->tail = task;
+    pthread_cond_signal(&q->ready);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/** @brief Zabiera wszystkie zadania z kolejki
+ *
+ * @param[in,out] q - kolejka
+ * @return pierwsze z zabranych zadań lub NULL
+ */
+job *queueTakeAll(queue *q) {
+    pthread_mutex_lock(&q->lock);
+    job *head = q->head;
+    q->head = q->tail = NULL;
+    pthread_mutex_unlock(&q->lock);
+    return head;
+}
+
+/** @brief Usuwa zadanie
+ *
+ * @param[in] task - zadanie
+ */
+void jobDelete(job *task) {
+    if (task == NULL) return;
+    free(task->requests.data);
+    free(task->responses.data);
+    free(task);
+}
+
+/** @brief Odczytuje napis z ramki
+ *
+ * @param[in] frame - ramka bez pola długości
+ * @param[in] length - długość ramki
+ * @param[in,out] offset - pozycja napisu, po odczycie pozycja za nim
+ * @param[out] result - kopia napisu zakończona zerem
+ * @return PHFWD_STATUS_OK albo status błędu
+ */
+int readString(unsigned char const *frame, size_t length, size_t *offset, char **result) {
+    if (length - *offset < 4) return PHFWD_STATUS_BAD_REQUEST;
+    uint32_t size = phfwdGetU32(frame + *offset);
+    *offset += 4;
+    if (length - *offset < size) return PHFWD_STATUS_BAD_REQUEST;
+
+    *result = malloc((size_t) size + 1);
+    if (*result == NULL) return PHFWD_STATUS_NO_MEMORY;
+    memcpy(*result, frame + *offset, size);
+    (*result)[size] = '\0';
+    *offset += size;
+    return PHFWD_STATUS_OK;
+}
+
+/** @brief Dopisuje odpowiedź do bufora
+ * Jeśli ramka przekroczyłaby PHFWD_MAX_FRAME, zamiast niej dopisuje pustą
+ * odpowiedź ze statusem PHFWD_STATUS_TOO_LARGE.
+ * @param[out] out - bufor odpowiedzi
+ * @param[in] id - identyfikator żądania
+ * @param[in] status - status odpowiedzi
+ * @param[in] pnum - numery wyniku lub NULL
+ * @return false , jak nie udało się alokować pamięci
+ */
+bool writeResponse(buffer *out, uint32_t id, int status, PhoneNumbers const *pnum) {
+    size_t start = out->length;
+    uint32_t count = 0;
+    unsigned char status_byte = (unsigned char) status;
+    if (!bufferAppendU32(out, 0) || !bufferAppendU32(out, id)
+        || !bufferAppend(out, &status_byte, 1) || !bufferAppendU32(out, 0)) {
+        out->length = start;
+        return false;
+    }
+
+    char const *num;
+    while ((num = phnumGet(pnum, count)) != NULL) {
+        size_t size = strlen(num);
+        if (out->length - start - PHFWD_LENGTH_SIZE + 4 + size > PHFWD_MAX_FRAME) {
+            out->length = start;
+            return writeResponse(out, id, PHFWD_STATUS_TOO_LARGE, NULL);
+        }
+        if (!bufferAppendU32(out, (uint32_t) size) || !bufferAppend(out, num, size)) {
+            out->length = start;
+            return false;
+        }
+        count++;
+    }
+    phfwdPutU32(out->data + start, (uint32_t) (out->length - start - PHFWD_LENGTH_SIZE));
+    phfwdPutU32(out->data + start + 9, count);
+    return true;
+}
+
+/** @brief Odczytuje żądanie z ramki
+ * Błąd ramki lub brak pamięci na napisy zapisuje w statusie żądania.
+ * @param[in] frame - ramka bez pola długości
+ * @param[in] length - długość ramki
+ * @param[out] req - żądanie
+ */
+void parseFrame(unsigned char const *frame, size_t length, request *req) {
+    memset(req, 0, sizeof(request));
+    if (length < 5) { req->status = PHFWD_STATUS_BAD_REQUEST; return; }
+    req->id = phfwdGetU32(frame);
+    req->op = frame[4];
+    size_t offset = 5;
+
+    req->status = readString(frame, length, &offset, &req->num1);
+    if (req->status == PHFWD_STATUS_OK && req->op == PHFWD_OP_ADD)
+        req->status = readString(frame, length, &offset, &req->num2);
+    if (req->status == PHFWD_STATUS_OK && (offset != length || req->op < PHFWD_OP_GET || req->op > PHFWD_OP_REMOVE))
+        req->status = PHFWD_STATUS_BAD_REQUEST;
+}
+
+/** @brief Zwalnia napisy i wynik żądania
+ *
+ * @param[in,out] req - żądanie
+ */
+void requestClear(request *req) {
+    free(req->num1);
+    free(req->num2);
+    phnumDelete(req->pnum);
+}
+
+/** @brief Sprawdza, czy żądanie tylko czyta strukturę
+ *
+ * @param[in] req - żądanie
+ * @return true , jak żądanie jest poprawne i nie zmienia struktury
+ */
+bool isRead(request const *req) {
+    return req->status == PHFWD_STATUS_OK && req->op != PHFWD_OP_ADD && req->op != PHFWD_OP_REMOVE;
+}
+
+/** @brief Wykonuje ciąg żądań czytających
+ * Kolejne żądania PHFWD_OP_GET lub PHFWD_OP_REVERSE wykonuje jednym
+ * wywołaniem phfwdGetBatch lub phfwdReverseBatch. Jeśli na to zabraknie
+ * pamięci, wykonuje je pojedynczo. Wywołujący trzyma blokadę do czytania.
+ * @param[in] pf - struktura przekierowań
+ * @param[in,out] reqs - żądania, wszystkie czytające
+ * @param[in] count - liczba żądań
+ */
+void executeReads(PhoneForward const *pf, request *reqs, size_t count) {
+    char const *nums[MAX_REQUESTS];
+    PhoneNumbers *results[MAX_REQUESTS];
+    for (size_t i = 0, end; i < count; i = end) {
+        unsigned char op = reqs[i].op;
+        for (end = i; end < count && reqs[end].op == op; end++)
+            nums[end - i] = reqs[end].num1;
+
+        bool batched = false;
+        if (end - i > 1 && op == PHFWD_OP_GET) batched = phfwdGetBatch(pf, nums, end - i, results);
+        if (end - i > 1 && op == PHFWD_OP_REVERSE) batched = phfwdReverseBatch(pf, nums, end - i, results);
+        for (size_t j = i; j < end; j++) {
+            if (batched) reqs[j].pnum = results[j - i];
+            else if (op == PHFWD_OP_GET) reqs[j].pnum = phfwdGet(pf, reqs[j].num1);
+            else if (op == PHFWD_OP_REVERSE) reqs[j].pnum = phfwdReverse(pf, reqs[j].num1);
+            else reqs[j].pnum = phfwdGetReverse(pf, reqs[j].num1);
+            if (reqs[j].pnum == NULL) reqs[j].status = PHFWD_STATUS_NO_MEMORY;
+        }
+    }
+}
+
+/** @brief Wykonuje żądania w kolejności
+ * Ciąg kolejnych żądań czytających wykonuje pod jedną blokadą do czytania,
+ * każdą zmianę pod osobną blokadą do pisania.
+ * @param[in,out] srv - serwer
+ * @param[in,out] reqs - żądania
+ * @param[in] count - liczba żądań
+ */
+void executeRequests(server *srv, request *reqs, size_t count) {
+    for (size_t i = 0; i < count; ) {
+        request *req = &reqs[i];
+        if (req->status != PHFWD_STATUS_OK) { i++; continue; }
+        if (isRead(req)) {
+            size_t end = i;
+            while (end < count && isRead(&reqs[end])) end++;
+            pthread_rwlock_rdlock(&srv->lock);
+            executeReads(srv->pf, reqs + i, end - i);
+            pthread_rwlock_unlock(&srv->lock);
+            i = end;
+            continue;
+        }
+
+        pthread_rwlock_wrlock(&srv->lock);
+        if (req->op == PHFWD_OP_ADD && !phfwdAdd(srv->pf, req->num1, req->num2))
+            req->status = PHFWD_STATUS_FAILED;
+        if (req->op == PHFWD_OP_REMOVE) phfwdRemove(srv->pf, req->num1);
+        pthread_rwlock_unlock(&srv->lock);
+        i++;
+    }
+}
+
+/** @brief Wykonuje wszystkie żądania zadania
+ * Żądania są wykonywane porcjami po co najwyżej MAX_REQUESTS. Jeśli na
+ * odpowiedź zabraknie pamięci, żądanie dostaje odpowiedź o braku pamięci, a
+ * jeśli i na nią zabraknie, zadanie jest oznaczane jako nieudane.
+ * @param[in,out] srv - serwer
+ * @param[in,out] task - zadanie
+ */
+void executeJob(server *srv, job *task) {
+    request reqs[MAX_REQUESTS];
+    size_t offset = 0;
+    while (offset < task->requests.length && !task->failed) {
+        size_t count = 0;
+        while (count < MAX_REQUESTS && offset < task->requests.length) {
+            uint32_t length = phfwdGetU32(task->requests.data + offset);
+            offset += PHFWD_LENGTH_SIZE;
+            parseFrame(task->requests.data + offset, length, &reqs[count++]);
+            offset += length;
+        }
+
+        executeRequests(srv, reqs, count);
+        for (size_t i = 0; i < count; i++) {
+            request *req = &reqs[i];
+            if (!task->failed && !writeResponse(&task->responses, req->id, req->status, req->pnum)
+                && !writeResponse(&task->responses, req->id, PHFWD_STATUS_NO_MEMORY, NULL))
+                task->failed = true;
+            requestClear(req);
+        }
+    }
+}
+
+/** @brief Wątek roboczy
+ * Wykonuje zadania z kolejki, dopóki serwer nie zacznie się zamykać.
+ * @param[in] arg - wskaźnik na serwer
+ * @return NULL
+ */
+void *worker(void *arg) {
+    server *srv = arg;
+    while (true) {
+        pthread_mutex_lock(&srv->todo.lock);
+        while (srv->todo.head == NULL && !srv->todo.stop)
+            pthread_cond_wait(&srv->todo.ready, &srv->todo.lock);
+        job *task = srv->todo.head;
+        if (task != NULL) {
+            srv->todo.head = task->next;
+            if (srv->todo.head == NULL) srv->todo.tail = NULL;
+        }
+        pthread_mutex_unlock(&srv->todo.lock);
+        if (task == NULL) return NULL;
+
+        executeJob(srv, task);
+        queuePush(&srv->done, task);
+        uint64_t one = 1;
+        if (write(srv->event_fd, &one, sizeof(one)) < 0) perror("write");
+    }
+}
+
+/** @brief Odkłada zamknięte połączenie do zwolnienia
+ * Przenosi połączenie z listy otwartych na listę zamkniętych.
+ * @param[in,out] srv - serwer
+ * @param[in] conn - połączenie
+ */
+void connectionRetire(server *srv, connection *conn) {
+    if (conn->prev) conn->prev->next = conn->next;
+    else srv->connections = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    conn->prev = NULL;
+    conn->next = srv->closed;
+    srv->closed = conn;
+}
+
+/** @brief Zwalnia zamknięte połączenia
+ *
+ * @param[in,out] srv - serwer
+ */
+void reapConnections(server *srv) {
+    while (srv->closed != NULL) {
+        connection *conn = srv->closed;
+        srv->closed = conn->next;
+        free(conn->in.data);
+        free(conn->out.data);
+        free(conn);
+    }
+}
+
+/** @brief Zamyka połączenie
+ * Jeśli zadanie z połączenia jest w pracy, połączenie zostanie odłożone do
+ * zwolnienia po jego powrocie.
+ * @param[in,out] srv - serwer
+ * @param[in] conn - połączenie
+ */
+void connectionClose(server *srv, connection *conn) {
+    if (conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    if (!conn->busy) connectionRetire(srv, conn);
+}
+
+/** @brief Wysyła zaległe odpowiedzi
+ *
+ * @param[in,out] srv - serwer
+ * @param[in] conn - połączenie
+ * @return false , jak połączenie zostało zamknięte
+ */
+bool connectionFlush(server *srv, connection *conn) {
+    while (conn->sent < conn->out.length) {
+        ssize_t sent = send(conn->fd, conn->out.data + conn->sent, conn->out.length - conn->sent, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (sent < 0) { connectionClose(srv, conn); return false; }
+        conn->sent += (size_t) sent;
+    }
+    if (conn->sent == conn->out.length) conn->sent = conn->out.length = 0;
+    return true;
+}
+
+/** @brief Przekazuje pełne ramki połączenia do wątków roboczych
+ * Nie robi nic, póki zadanie połączenia jest w pracy albo zaległe odpowiedzi
+ * przekraczają MAX_BUFFERED.
+ * @param[in,out] srv - serwer
+ * @param[in] conn - połączenie
+ * @return false , jak połączenie zostało zamknięte
+ */
+bool connectionDispatch(server *srv, connection *conn) {
+    if (conn->busy || conn->out.length >= MAX_BUFFERED) return true;
+
+    size_t offset = 0;
+    while (conn->in.length - offset >= PHFWD_LENGTH_SIZE) {
+        uint32_t length = phfwdGetU32(conn->in.data + offset);
+        if (length > PHFWD_MAX_FRAME) { connectionClose(srv, conn); return false; }
+        if (conn->in.length - offset - PHFWD_LENGTH_SIZE < length) break;
+        offset += PHFWD_LENGTH_SIZE + length;
+    }
+    if (offset == 0) return true;
+
+    job *task = calloc(1, sizeof(job));
+    if (task == NULL || !bufferAppend(&task->requests, conn->in.data, offset)) {
+        jobDelete(task);
+        connectionClose(srv, conn);
+        return false;
+    }
+    memmove(conn->in.data, conn->in.data + offset, conn->in.length - offset);
+    conn->in.length -= offset;
+
+    task->conn = conn;
+    conn->busy = true;
+    queuePush(&srv->todo, task);
+    return true;
+}
+
+/** @brief Ustawia zdarzenia, na które czekamy w epoll
+ * Czekamy na EPOLLIN tylko wtedy, gdy połączenie nie ma zadania w pracy, a
+ * oba bufory są poniżej MAX_BUFFERED, i na EPOLLOUT, gdy są zaległe
+ * odpowiedzi.
+ * @param[in,out] srv - serwer
+ * @param[in] conn - połączenie
+ */
+void connectionWatch(server *srv, connection *conn) {
+    uint32_t events = 0;
+    if (!conn->busy && conn->in.length < MAX_BUFFERED && conn->out.length < MAX_BUFFERED)
+        events |= EPOLLIN;
+    if (conn->out.length > 0) events |= EPOLLOUT;
+    if (events == conn->events) return;
+
+    struct epoll_event event = { .events = events, .data.ptr = conn };
+    if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event) < 0) {
+        connectionClose(srv, conn);
+        return;
+    }
+    conn->events = events;
+}
+
+/** @brief Czyta dane z połączenia
+ * Czyta, dopóki są dane, ale nie więcej niż do MAX_BUFFERED bajtów w
+ * buforze; resztę odczyta po następnym EPOLLIN.
+ * @param[in,out] srv - serwer
+ * @param[in] conn - połączenie
+ * @return false , jak połączenie zostało zamknięte
+ */
+bool connectionRead(server *srv, connection *conn) {
+    while (conn->in.length < MAX_BUFFERED) {
+        if (!bufferReserve(&conn->in, READ_CHUNK)) { connectionClose(srv, conn); return false; }
+        ssize_t got = recv(conn->fd, conn->in.data + conn->in.length, conn->in.capacity - conn->in.length, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (got <= 0) { connectionClose(srv, conn); return false; }
+        conn->in.length += (size_t) got;
+    }
+    return true;
+}
+
+/** @brief Przyjmuje nowe połączenia
+ *
+ * @param[in,out] srv - serwer
+ */
+void acceptConnections(server *srv) {
+    while (true) {
+        int fd = accept4(srv->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept4");
+            return;
+        }
+
+        connection *conn = calloc(1, sizeof(connection));
+        if (conn == NULL) { close(fd); continue; }
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        conn->next = srv->connections;
+        if (conn->next) conn->next->prev = conn;
+        srv->connections = conn;
+    }
+}
+
+/** @brief Odbiera wykonane zadania
+ * Dopisuje odpowiedzi do połączeń, wysyła je i przekazuje dalej ramki, które
+ * przyszły w międzyczasie.
+ * @param[in,out] srv - serwer
+ */
+void collectResults(server *srv) {
+    uint64_t counter;
+    if (read(srv->event_fd, &counter, sizeof(counter)) < 0 && errno != EAGAIN) perror("read");
+
+    job *task = queueTakeAll(&srv->done);
+    while (task != NULL) {
+        job *next = task->next;
+        connection *conn = task->conn;
+        conn->busy = false;
+        if (conn->fd < 0) connectionRetire(srv, conn);
+        else if (task->failed || !bufferAppend(&conn->out, task->responses.data, task->responses.length))
+            connectionClose(srv, conn);
+        else if (connectionFlush(srv, conn) && connectionDispatch(srv, conn))
+            connectionWatch(srv, conn);
+        jobDelete(task);
+        task = next;
+    }
+}
+
+/** @brief Tworzy gniazdo nasłuchujące
+ *
+ * @param[in] path - ścieżka gniazda
+ * @return deskryptor gniazda lub -1
+ */
+int listenOn(char const *path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long\n");
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("socket"); return -1; }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/** @brief Główna pętla serwera
+ * Połączenia zamknięte przy obsłudze zdarzeń są zwalniane dopiero po
+ * obsłużeniu wszystkich zdarzeń odebranych razem z nimi.
+ * @param[in,out] srv - serwer
+ */
+void eventLoop(server *srv) {
+    struct epoll_event events[MAX_EVENTS];
+    while (!stopping) {
+        int count = epoll_wait(srv->epoll_fd, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            return;
+        }
+        for (int i = 0; i < count; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &srv->listen_fd) acceptConnections(srv);
+            else if (ptr == &srv->event_fd) collectResults(srv);
+            else {
+                connection *conn = ptr;
+                if (conn->fd < 0) continue;
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) { connectionClose(srv, conn); continue; }
+                if ((events[i].events & EPOLLOUT) && !connectionFlush(srv, conn)) continue;
+                if ((events[i].events & EPOLLIN) && !connectionRead(srv, conn)) continue;
+                if (connectionDispatch(srv, conn)) connectionWatch(srv, conn);
+            }
+        }
+        reapConnections(srv);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s SOCKET_PATH [THREADS]\n", argv[0]);
+        return 1;
+    }
+    int threads = argc == 3 ? atoi(argv[2]) : DEFAULT_THREADS;
+    if (threads <= 0) threads = DEFAULT_THREADS;
+
+    server srv;
+    memset(&srv, 0, sizeof(srv));
+    srv.pf = phfwdNew();
+    srv.listen_fd = listenOn(argv[1]);
+    srv.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    srv.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    pthread_t *workers = malloc(sizeof(pthread_t) * (size_t) threads);
+    if (srv.pf == NULL || srv.listen_fd < 0 || srv.event_fd < 0 || srv.epoll_fd < 0 || workers == NULL) {
+        fprintf(stderr, "Cannot start server\n");
+        return 1;
+    }
+    pthread_rwlock_init(&srv.lock, NULL);
+    pthread_mutex_init(&srv.todo.lock, NULL);
+    pthread_cond_init(&srv.todo.ready, NULL);
+    pthread_mutex_init(&srv.done.lock, NULL);
+    pthread_cond_init(&srv.done.ready, NULL);
+
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = &srv.listen_fd };
+    epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.listen_fd, &event);
+    event.data.ptr = &srv.event_fd;
+    epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.event_fd, &event);
+
+    wakeup_fd = srv.event_fd;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int started = 0;
+    while (started < threads && pthread_create(&workers[started], NULL, worker, &srv) == 0)
+        started++;
+
+    if (started > 0) eventLoop(&srv);
+    else fprintf(stderr, "Cannot start worker threads\n");
+
+    pthread_mutex_lock(&srv.todo.lock);
+    srv.todo.stop = true;
+    pthread_cond_broadcast(&srv.todo.ready);
+    pthread_mutex_unlock(&srv.todo.lock);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    for (job *task = queueTakeAll(&srv.todo), *next; task != NULL; task = next) {
+        next = task->next;
+        task->conn->busy = false;
+        jobDelete(task);
+    }
+    for (job *task = queueTakeAll(&srv.done), *next; task != NULL; task = next) {
+        next = task->next;
+        task->conn->busy = false;
+        jobDelete(task);
+    }
+    while (srv.connections != NULL)
+        connectionClose(&srv, srv.connections);
+    reapConnections(&srv);
+
+    close(srv.listen_fd);
+    unlink(argv[1]);
+    close(srv.event_fd);
+    close(srv.epoll_fd);
+    free(workers);
+    phfwdDelete(srv.pf);
+    return started > 0 ? 0 : 1;
+}